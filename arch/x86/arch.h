@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <arch/x86/context_switch.h>
 #include <arch/x86/syscall.h>
+#include <arch/x86/percpu.h>
 
 typedef struct __attribute__((packed))
 {
@@ -39,10 +40,12 @@ typedef struct __attribute__((packed))
 #define arch_regs_set_retval(regs, retval) (regs)->rax = (retval)
 #define arch_regs_copy(dst, src) memcpy(dst, src, sizeof(arch_regs_t))
 
-typedef struct
+typedef struct arch_thread
 {
     uint8_t* kstack_top;
     context_t context;
+    // FPU/SSE/AVX registers saved by fpu.c, allocated with the thread
+    void* fpu_state;
 } arch_thread_t;
 
 /**
@@ -1,4 +1,4 @@
-section .text
+section .text.hot progbits alloc exec nowrite align=16
     global context_switch
     context_switch:
         push rbx
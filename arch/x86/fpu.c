@@ -0,0 +1,194 @@
+#include <arch/x86/fpu.h>
+#include <arch/x86/x86.h>
+#include <arch/x86/irq.h>
+#include <kernel/panic.h>
+#include <mm/kmalloc.h>
+#include <sched/sched.h>
+
+#define CPUID_1_ECX_XSAVE     (1 << 26)
+#define CPUID_D_1_EAX_XSAVEOPT (1 << 0)
+
+#define XCR0 0
+
+#define FXSAVE_AREA_SIZE 512
+#define FPU_STATE_ALIGN  64
+
+// Default control words, all exceptions are masked
+#define FCW_DEFAULT   0x37f
+#define MXCSR_DEFAULT 0x1f80
+
+// Legacy region at the start of both FXSAVE and XSAVE areas
+typedef struct __attribute__((packed)) fxsave_header
+{
+    uint16_t fcw;
+    uint16_t fsw;
+    uint8_t ftw;
+    uint8_t reserved;
+    uint16_t fop;
+    uint64_t fip;
+    uint64_t fdp;
+    uint32_t mxcsr;
+    uint32_t mxcsr_mask;
+} fxsave_header_t;
+
+uint64_t fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+
+static bool use_xsave = false;
+static bool use_xsaveopt = false;
+static size_t state_size = FXSAVE_AREA_SIZE;
+
+static void* fpu_state_alloc();
+static void fpu_save(void* state);
+static void fpu_restore(void* state);
+
+void fpu_init()
+{
+    bool xsave = x86_cpuid(1, 0).ecx & CPUID_1_ECX_XSAVE;
+
+    x86_write_cr0((x86_read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+
+    uint64_t cr4 = x86_read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (xsave)
+        cr4 |= CR4_OSXSAVE;
+    x86_write_cr4(cr4);
+
+    if (xsave)
+    {
+        uint64_t supported = x86_cpuid(0xd, 0).eax;
+        uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
+        if (supported & XCR0_AVX)
+            xcr0 |= XCR0_AVX;
+        // AVX-512 state components can be enabled only together
+        if ((supported & XCR0_AVX512) == XCR0_AVX512 && (xcr0 & XCR0_AVX))
+            xcr0 |= XCR0_AVX512;
+        x86_xsetbv(XCR0, xcr0);
+        fpu_xcr0 = xcr0;
+
+        // Size of XSAVE area for the enabled components
+        state_size = x86_cpuid(0xd, 0).ebx;
+        use_xsave = true;
+        use_xsaveopt = x86_cpuid(0xd, 1).eax & CPUID_D_1_EAX_XSAVEOPT;
+    }
+}
+
+void fpu_switch_to(arch_thread_t* next)
+{
+    // Owner's registers are still loaded, others trap on the first FPU instruction.
+    // CR0 writes are serializing, consecutive switches between non-owners skip them
+    uint64_t cr0 = x86_read_cr0();
+    bool ts = percpu_read(fpu_owner) != next;
+    if (ts != ((cr0 & CR0_TS) != 0))
+        x86_write_cr0(cr0 ^ CR0_TS);
+}
+
+int fpu_thread_init(arch_thread_t* thread)
+{
+    thread->fpu_state = fpu_state_alloc();
+    return thread->fpu_state == NULL ? -ENOMEM : 0;
+}
+
+int fpu_thread_clone(arch_thread_t* dst, arch_thread_t* src)
+{
+    dst->fpu_state = kmalloc(state_size);
+    if (dst->fpu_state == NULL)
+        return -ENOMEM;
+
+    // Registers are newer than the saved copy
+    if (percpu_read(fpu_owner) == src)
+        fpu_save(src->fpu_state);
+
+    memcpy(dst->fpu_state, src->fpu_state, state_size);
+    return 0;
+}
+
+void fpu_thread_destroy(arch_thread_t* thread)
+{
+    if (percpu_read(fpu_owner) == thread)
+        percpu_write(fpu_owner, NULL);
+
+    if (thread->fpu_state != NULL)
+    {
+        kfree(thread->fpu_state);
+        thread->fpu_state = NULL;
+    }
+}
+
+bool fpu_handle_nm(arch_regs_t* ctx)
+{
+    // Kernel is built without FPU code
+    if ((ctx->cs & 3) == 0 || sched_current() == NULL)
+        return false;
+
+    // State is allocated with the thread, so nothing here can enter a kernel FPU region
+    arch_thread_t* thread = &sched_current()->arch_thread;
+    arch_thread_t* owner = percpu_read(fpu_owner);
+
+    x86_clts();
+    if (owner == thread)
+        return true;
+
+    if (owner != NULL)
+        fpu_save(owner->fpu_state);
+
+    fpu_restore(thread->fpu_state);
+    percpu_write(fpu_owner, thread);
+    return true;
+}
+
+void kernel_fpu_begin()
+{
+    bool enabled = irq_save();
+
+    // Registers are about to be overwritten
+    arch_thread_t* owner = percpu_read(fpu_owner);
+    x86_clts();
+    if (owner != NULL)
+    {
+        fpu_save(owner->fpu_state);
+        percpu_write(fpu_owner, NULL);
+    }
+
+    percpu_write(kernel_fpu_irq, enabled);
+}
+
+void kernel_fpu_end()
+{
+    // Registers belong to nobody now, next FPU user traps and loads its state
+    x86_write_cr0(x86_read_cr0() | CR0_TS);
+    irq_restore(percpu_read(kernel_fpu_irq));
+}
+
+static void* fpu_state_alloc()
+{
+    // kmalloc caches of this size are cache line aligned
+    void* state = kmalloc(state_size);
+    if (state == NULL)
+        return NULL;
+
+    kassert(((uint64_t)state & (FPU_STATE_ALIGN - 1)) == 0);
+
+    // Zero XSAVE header means initial state of all components except MXCSR
+    memset(state, 0, state_size);
+    fxsave_header_t* header = state;
+    header->fcw = FCW_DEFAULT;
+    header->mxcsr = MXCSR_DEFAULT;
+    return state;
+}
+
+static void fpu_save(void* state)
+{
+    if (use_xsaveopt)
+        __asm__ volatile("xsaveopt64 (%0)" : : "r"(state), "a"(-1), "d"(-1) : "memory");
+    else if (use_xsave)
+        __asm__ volatile("xsave64 (%0)" : : "r"(state), "a"(-1), "d"(-1) : "memory");
+    else
+        __asm__ volatile("fxsave64 (%0)" : : "r"(state) : "memory");
+}
+
+static void fpu_restore(void* state)
+{
+    if (use_xsave)
+        __asm__ volatile("xrstor64 (%0)" : : "r"(state), "a"(-1), "d"(-1) : "memory");
+    else
+        __asm__ volatile("fxrstor64 (%0)" : : "r"(state) : "memory");
+}
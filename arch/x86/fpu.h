@@ -0,0 +1,76 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdbool.h>
+#include <arch/x86/arch.h>
+
+#define XCR0_X87    (1 << 0)
+#define XCR0_SSE    (1 << 1)
+#define XCR0_AVX    (1 << 2)
+#define XCR0_AVX512 (7 << 5)
+
+// State components enabled in XCR0, x87 and SSE only if XSAVE is not supported
+extern uint64_t fpu_xcr0;
+
+/**
+ * Enables FPU, SSE and, when supported, XSAVE-managed AVX state. 
+ * FPU state is switched lazily: CR0.TS is set while a thread not owning FPU registers runs 
+ * and its first FPU instruction raises #NM
+ */
+void fpu_init();
+
+/**
+ * Prepares FPU for running given thread. Called on every context switch
+ * 
+ * \param next Thread to run
+ */
+void fpu_switch_to(arch_thread_t* next);
+
+/**
+ * Allocates initial FPU state of a new thread
+ * 
+ * \param thread New thread
+ * 
+ * \return Error code
+ */
+int fpu_thread_init(arch_thread_t* thread);
+
+/**
+ * Copies FPU state of the current thread to a new one
+ * 
+ * \param dst New thread
+ * \param src Current thread
+ * 
+ * \return Error code
+ */
+int fpu_thread_clone(arch_thread_t* dst, arch_thread_t* src);
+
+/**
+ * Frees FPU state of the thread
+ * 
+ * \param thread Thread
+ */
+void fpu_thread_destroy(arch_thread_t* thread);
+
+/**
+ * Allows kernel code to use FPU/SIMD registers until kernel_fpu_end. 
+ * Saves the owner's state and disables interrupts, so the region must be short and must not sleep. 
+ * Regions don't nest
+ */
+void kernel_fpu_begin();
+
+/**
+ * Ends kernel FPU region, restores interrupts flag
+ */
+void kernel_fpu_end();
+
+/**
+ * #NM handler, loads FPU state of the current thread
+ * 
+ * \param ctx Interrupted context
+ * 
+ * \return True if handled, false if FPU was used by the kernel
+ */
+bool fpu_handle_nm(arch_regs_t* ctx);
+
+#endif
@@ -1,9 +1,12 @@
 #include <arch/x86/irq.h>
 #include <kernel/panic.h>
 #include <arch/x86/x86.h>
+#include <arch/x86/fpu.h>
 #include <drivers/apic.h>
 #include <mm/vmem.h>
 #include <sched/sched.h>
+#include <kernel/kprof.h>
+#include <kernel/time.h>
 
 static const char *exc_names[] =
 {
@@ -31,12 +34,12 @@ static const char *exc_names[] =
     "Control Protection Exception"
 };
 
-static void timer_handler();
+static void timer_handler(arch_regs_t* ctx);
 static void spurious_handler();
-static void dump(arch_regs_t* ctx);
+__cold static void dump(arch_regs_t* ctx);
 static const char *get_irq_name(int irq_num);
 
-void irq_handler(arch_regs_t* ctx)
+__hot void irq_handler(arch_regs_t* ctx)
 {
     if (ctx->irq_num == IRQ_PF)
     {
@@ -44,6 +47,12 @@ void irq_handler(arch_regs_t* ctx)
             return;
     }
 
+    if (ctx->irq_num == IRQ_NM)
+    {
+        if (fpu_handle_nm(ctx))
+            return;
+    }
+
     switch (ctx->irq_num)
     {
     case IRQ_TIMER:
@@ -61,10 +70,29 @@ void irq_handler(arch_regs_t* ctx)
     }
 }
 
-static void timer_handler()
+__hot void irq_exit()
+{
+    // IRQ stack is shared by all tasks, so the switch is done on the task stack
+    if (percpu_read(need_resched))
+    {
+        percpu_write(need_resched, false);
+        sched_switch();
+        // Returned to this task at the moment
+    }
+}
+
+static void timer_handler(arch_regs_t* ctx)
 {
+#ifdef KPROF
+    // Only kernel code is profiled
+    if ((ctx->cs & 3) == 0)
+        kprof_sample(ctx->rip);
+#else
+    UNUSED(ctx);
+#endif
+
     apic_eoi();
-    sched_timer_tick();
+    time_handle_timer();
 }
 
 static void spurious_handler()
@@ -72,7 +100,7 @@ static void spurious_handler()
     apic_eoi();
 }
 
-static void dump(arch_regs_t* ctx)
+__cold static void dump(arch_regs_t* ctx)
 {
     printk("Unhandled IRQ %d [%s]\n", ctx->irq_num, get_irq_name(ctx->irq_num));
     printk("Error code: %d\n", ctx->errcode);
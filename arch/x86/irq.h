@@ -1,10 +1,23 @@
 #ifndef IRQ_H
 #define IRQ_H
 
+#include <stdbool.h>
 #include <arch/x86/arch.h>
+#include <mm/mem_layout.h>
+
+// Per-CPU stack of interrupt handlers, keep in sync with irq_asm.asm
+#define IRQ_STACK_SIZE (4 * PAGE_SIZE)
+
+// Stacks in the interrupt stack table, exceptions which may hit a broken stack use them
+#define IST_STACK_SIZE PAGE_SIZE
+#define IST_DF    1
+#define IST_NMI   2
+#define IST_MC    3
+#define IST_COUNT 3
 
 typedef enum
 {
+    IRQ_NMI      = 2,  // Non-maskable interrupt
     IRQ_UD       = 6,  // Illegal opcode
     IRQ_NM       = 7,  // No math coprocessorNon-maskable interrupt
     IRQ_DF       = 8,  // Double fault
@@ -13,6 +26,7 @@ typedef enum
     IRQ_SS       = 12, // Stack segment fault
     IRQ_GP       = 13, // General protection fault
     IRQ_PF       = 14, // Page fault
+    IRQ_MC       = 18, // Machine check
     IRQ_TIMER    = 32,
     IRQ_SPURIOUS = 39
 } irq_t;
@@ -22,6 +36,12 @@ typedef enum
  */
 void irq_init();
 
+/**
+ * Called by interrupt entry code after switching back from the IRQ stack, 
+ * performs task switch requested by the handler
+ */
+void irq_exit();
+
 static inline void irq_disable()
 {
     __asm__ volatile ("cli");
@@ -32,4 +52,22 @@ static inline void irq_enable()
     __asm__ volatile ("sti");
 }
 
+/**
+ * Disables interrupts
+ * 
+ * \return Whether interrupts were enabled, pass it to irq_restore
+ */
+static inline bool irq_save()
+{
+    uint64_t rflags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(rflags) : : "memory");
+    return rflags & (1 << 9);
+}
+
+static inline void irq_restore(bool enabled)
+{
+    if (enabled)
+        irq_enable();
+}
+
 #endif
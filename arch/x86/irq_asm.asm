@@ -1,8 +1,20 @@
 IDT_DESC_SIZE: equ 16
 KERNEL_CODE64: equ 8
 
-; params: vec selector flags
-%macro IDT_ENTRY 3
+; Keep in sync with arch/x86/irq.h and arch/x86/percpu.h
+IRQ_STACK_SIZE:       equ 4 * 4096
+PERCPU_IRQ_STACK_TOP: equ 32
+
+; Keep in sync with arch/x86/msr.h
+IA32_GS_BASE: equ 0xc0000101
+
+%define IST_NONE 0
+%define IST_DF   1
+%define IST_NMI  2
+%define IST_MC   3
+
+; params: vec selector flags ist
+%macro IDT_ENTRY 4
     ; rbx = &IDT[vec]
     lea rbx, [rel idt + %1 * IDT_DESC_SIZE]
 
@@ -12,10 +24,10 @@ KERNEL_CODE64: equ 8
     or  eax, %2 << 16
     mov dword [rbx], eax
 
-    ; second dword = (entry & 0xFFFF0000) | (flags << 8)
+    ; second dword = (entry & 0xFFFF0000) | (flags << 8) | ist
     lea rax, [rel _irq_entry_%1]
     and eax, 0xFFFF0000
-    or  eax, (%3 << 8)
+    or  eax, (%3 << 8) | %4
     mov dword [rbx + 4], eax
 
     ; third dword = entry >> 32
@@ -33,9 +45,13 @@ KERNEL_CODE64: equ 8
 %define GATE_INTERRUPT 0b10001110
 %define GATE_TRAP      0b10001111
 
-; params: vector errcode
-%macro IRQ_ENTRY 2
-    section .text
+; params: vector errcode ist
+; Vectors without IST switch to the per-CPU IRQ stack unless they are nested, 
+; IST ones already run on a dedicated stack. 
+; NMI and #MC may arrive in syscall_entry before its swapgs or in the exit path after it, 
+; so IST entries check GS base itself instead of the saved cs
+%macro IRQ_ENTRY 3
+    section .text.hot progbits alloc exec nowrite align=16
     align 16
 
 _irq_entry_%1:
@@ -47,6 +63,14 @@ _irq_entry_%1:
     ; Push IRQ number
     push qword %1
 
+%if %3 == IST_NONE
+    ; Load kernel GS base if interrupted in user mode (check RPL of the saved cs)
+    test qword [rsp + 24], 3
+    jz %%from_kernel
+    swapgs
+%%from_kernel:
+%endif
+
     ; First of all, save GPRs on stack.
     push rax
     push rbx
@@ -64,9 +88,52 @@ _irq_entry_%1:
     push r14
     push r15
 
+%if %3 != IST_NONE
+    ; Per-CPU areas are in the higher half, user GS base is not. 
+    ; rbx is preserved by C code and remembers whether to swap back
+    xor ebx, ebx
+    mov ecx, IA32_GS_BASE
+    rdmsr
+    test edx, edx
+    js %%kernel_gs
+    swapgs
+    mov ebx, 1
+%%kernel_gs:
+%endif
+
     ; Pass pointer for struct irqctx* which is current stack top.
     mov rdi, rsp
+%if %3 == IST_NONE
+    ; Nested interrupt is already on the IRQ stack
+    mov rax, [gs:PERCPU_IRQ_STACK_TOP]
+    mov rcx, rax
+    sub rcx, rsp
+    cmp rcx, IRQ_STACK_SIZE
+    jb %%nested
+
+    ; Save interrupted stack pointer, padding keeps the stack aligned
+    mov rsp, rax
+    push rdi
+    sub rsp, 8
     call irq_handler
+    add rsp, 8
+    pop rsp
+
+    ; Back on the interrupted stack, switch tasks if requested
+    call irq_exit
+    jmp %%restore
+
+%%nested:
+%endif
+    call irq_handler
+%%restore:
+
+%if %3 != IST_NONE
+    test ebx, ebx
+    jz %%keep_gs
+    swapgs
+%%keep_gs:
+%endif
 
     pop r15
     pop r14
@@ -87,6 +154,14 @@ _irq_entry_%1:
     ; Skip error code and IRQ number.
     add rsp, 16
 
+%if %3 == IST_NONE
+    ; Restore user GS base if returning to user mode
+    test qword [rsp + 8], 3
+    jz %%to_kernel
+    swapgs
+%%to_kernel:
+%endif
+
     ; Return from interrupt.
     iretq
 %endmacro
@@ -102,37 +177,43 @@ section .data
 
 section .text
     extern irq_handler
+    extern irq_exit
 
     ; Interrupt handlers
-    ;         Vec Errcode present
-    IRQ_ENTRY 6,  ERRCODE
-    IRQ_ENTRY 7,  NOERRCODE
-    IRQ_ENTRY 8,  ERRCODE
-    IRQ_ENTRY 10, ERRCODE
-    IRQ_ENTRY 11, ERRCODE
-    IRQ_ENTRY 12, ERRCODE
-    IRQ_ENTRY 13, ERRCODE
-    IRQ_ENTRY 14, ERRCODE
-    IRQ_ENTRY 32, NOERRCODE
-    IRQ_ENTRY 39, NOERRCODE
+    ;         Vec Errcode present IST
+    IRQ_ENTRY 2,  NOERRCODE,      IST_NMI
+    IRQ_ENTRY 6,  ERRCODE,        IST_NONE
+    IRQ_ENTRY 7,  NOERRCODE,      IST_NONE
+    IRQ_ENTRY 8,  ERRCODE,        IST_DF
+    IRQ_ENTRY 10, ERRCODE,        IST_NONE
+    IRQ_ENTRY 11, ERRCODE,        IST_NONE
+    IRQ_ENTRY 12, ERRCODE,        IST_NONE
+    IRQ_ENTRY 13, ERRCODE,        IST_NONE
+    IRQ_ENTRY 14, ERRCODE,        IST_NONE
+    IRQ_ENTRY 18, NOERRCODE,      IST_MC
+    IRQ_ENTRY 32, NOERRCODE,      IST_NONE
+    IRQ_ENTRY 39, NOERRCODE,      IST_NONE
 
+section .text
     global irq_init
     irq_init:
         push rbp
         mov rbp, rsp
         
         ; IDT entries
-        ;         Vec Selector       Flags
-        IDT_ENTRY 6,  KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 7,  KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 8,  KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 10, KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 11, KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 12, KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 13, KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 14, KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 32, KERNEL_CODE64, GATE_INTERRUPT
-        IDT_ENTRY 39, KERNEL_CODE64, GATE_INTERRUPT
+        ;         Vec Selector       Flags           IST
+        IDT_ENTRY 2,  KERNEL_CODE64, GATE_INTERRUPT, IST_NMI
+        IDT_ENTRY 6,  KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 7,  KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 8,  KERNEL_CODE64, GATE_INTERRUPT, IST_DF
+        IDT_ENTRY 10, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 11, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 12, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 13, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 14, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 18, KERNEL_CODE64, GATE_INTERRUPT, IST_MC
+        IDT_ENTRY 32, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
+        IDT_ENTRY 39, KERNEL_CODE64, GATE_INTERRUPT, IST_NONE
 
         lidt [rel idt_ptr]
 
@@ -15,7 +15,14 @@
 #define IA32_GS_BASE        0xc0000101
 #define IA32_KERNEL_GS_BASE 0xc0000102
 
-void x86_wrmsr(uint32_t msr, uint64_t x)
+#define IA32_APIC_BASE        0x1b
+#define IA32_APIC_BASE_X2APIC (1<<10)
+#define IA32_APIC_BASE_ENABLE (1<<11)
+
+// Local APIC registers in x2APIC mode, MSR index is MMIO offset / 16
+#define IA32_X2APIC_BASE 0x800
+
+static inline void x86_wrmsr(uint32_t msr, uint64_t x)
 {
     uint32_t hi = (uint32_t)(x >> 32);
     uint32_t lo = x & 0xffffffff;
@@ -31,7 +38,7 @@ void x86_wrmsr(uint32_t msr, uint64_t x)
     );
 }
 
-uint64_t x86_rdmsr(uint32_t msr)
+static inline uint64_t x86_rdmsr(uint32_t msr)
 {
     uint32_t lo;
     uint32_t hi;
@@ -0,0 +1,87 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Maximum amount of CPUs the kernel can manage
+#define MAX_CPU_COUNT 8
+
+// Offsets used by arch/x86/syscall.asm and arch/x86/irq_asm.asm
+#define PERCPU_KSTACK_TOP_OFFSET    16
+#define PERCPU_RSP_SCRATCH_OFFSET   24
+#define PERCPU_IRQ_STACK_TOP_OFFSET 32
+
+struct task;
+struct arch_thread;
+
+/**
+ * Per-CPU data. GS base points to it while CPU runs kernel code, 
+ * user GS base is kept in IA32_KERNEL_GS_BASE and swapped on every kernel entry and exit from user mode
+ */
+typedef struct percpu
+{
+    // Address of this area
+    struct percpu* self;
+    // Task running on this CPU, NULL while the scheduler runs
+    struct task* current;
+    // Kernel stack top of the current task, syscall_entry switches to it
+    uint8_t* kstack_top;
+    // User rsp is saved here by syscall_entry until the kernel stack is set up
+    uint64_t rsp_scratch;
+    // Interrupt handlers switch to this stack unless they are nested
+    uint8_t* irq_stack_top;
+    uint32_t cpu_index;
+    // NUMA node of this CPU, set by numa_cpu_init
+    int numa_node;
+    // Thread whose FPU state is loaded into this CPU's registers
+    struct arch_thread* fpu_owner;
+    // Interrupts flag saved by kernel_fpu_begin
+    bool kernel_fpu_irq;
+    // Interrupt handler asks to switch to the scheduler once it's back on the task stack
+    bool need_resched;
+} __attribute__((aligned(64))) percpu_t;
+
+_Static_assert(offsetof(percpu_t, kstack_top) == PERCPU_KSTACK_TOP_OFFSET, "syscall.asm expects kstack_top offset");
+_Static_assert(offsetof(percpu_t, rsp_scratch) == PERCPU_RSP_SCRATCH_OFFSET, "syscall.asm expects rsp_scratch offset");
+_Static_assert(offsetof(percpu_t, irq_stack_top) == PERCPU_IRQ_STACK_TOP_OFFSET, "irq_asm.asm expects irq_stack_top offset");
+
+#define percpu_read(field) ({                                   \
+    typeof(((percpu_t*)0)->field) __val;                        \
+    __asm__ volatile("mov %%gs:%c1, %0"                         \
+        : "=r"(__val)                                           \
+        : "i"(offsetof(percpu_t, field)));                      \
+    __val; })
+
+#define percpu_write(field, val)                                \
+    __asm__ volatile("mov %0, %%gs:%c1"                         \
+        :                                                       \
+        : "r"((typeof(((percpu_t*)0)->field))(val)),            \
+          "i"(offsetof(percpu_t, field))                        \
+        : "memory")
+
+/**
+ * \return Per-CPU area of the current CPU
+ */
+static inline percpu_t* percpu_this()
+{
+    return percpu_read(self);
+}
+
+/**
+ * Sets up per-CPU area of the calling CPU and loads GS base with it
+ * 
+ * \param cpu_index Index of the CPU
+ */
+void percpu_init(uint32_t cpu_index);
+
+/**
+ * \return Index of the current CPU
+ */
+static inline uint32_t arch_cpu_index()
+{
+    return percpu_read(cpu_index);
+}
+
+#endif
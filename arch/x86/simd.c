@@ -0,0 +1,202 @@
+#include <arch/x86/simd.h>
+#include <arch/x86/x86.h>
+#include <arch/x86/fpu.h>
+#include <kernel/printk.h>
+
+#define CPUID_7_EBX_AVX2    (1 << 5)
+#define CPUID_7_EBX_AVX512F (1 << 16)
+
+// Implementations process blocks of this size, the rest is copied by bulk_copy itself
+#define SIMD_BLOCK_SIZE 64
+
+// Entering kernel FPU region costs serializing CR0 writes and possibly XSAVE of the owner, 
+// so smaller operations use string instructions
+#define SIMD_MIN_SIZE (4 * PAGE_SIZE)
+
+// Interrupts are disabled in kernel FPU region, this bounds its length to a few microseconds
+#define SIMD_REGION_SIZE (16 * PAGE_SIZE)
+
+// Kernel is built with -mno-sse, so compiler never touches SIMD registers 
+// and they keep values between asm statements below
+
+typedef void (*copy_fn_t)(void* dst, const void* src, size_t size);
+typedef void (*clear_fn_t)(void* dst, size_t size);
+
+static void copy_scalar(void* dst, const void* src, size_t size);
+static void clear_scalar(void* dst, size_t size);
+static void copy_sse2(void* dst, const void* src, size_t size);
+static void clear_sse2(void* dst, size_t size);
+static void copy_avx2(void* dst, const void* src, size_t size);
+static void clear_avx2(void* dst, size_t size);
+static void copy_avx512(void* dst, const void* src, size_t size);
+static void clear_avx512(void* dst, size_t size);
+
+static copy_fn_t copy_impl = copy_scalar;
+static clear_fn_t clear_impl = clear_scalar;
+// Scalar implementation doesn't need kernel FPU region
+static bool impl_uses_fpu = false;
+
+void simd_init()
+{
+    x86_cpuid_regs_t leaf7 = x86_cpuid(0, 0).eax >= 7 ? x86_cpuid(7, 0) : (x86_cpuid_regs_t){};
+    const char* name;
+
+    if ((leaf7.ebx & CPUID_7_EBX_AVX512F) && (fpu_xcr0 & XCR0_AVX512))
+    {
+        copy_impl = copy_avx512;
+        clear_impl = clear_avx512;
+        name = "AVX-512";
+    }
+    else if ((leaf7.ebx & CPUID_7_EBX_AVX2) && (fpu_xcr0 & XCR0_AVX))
+    {
+        copy_impl = copy_avx2;
+        clear_impl = clear_avx2;
+        name = "AVX2";
+    }
+    else
+    {
+        // Every x86_64 CPU has SSE2
+        copy_impl = copy_sse2;
+        clear_impl = clear_sse2;
+        name = "SSE2";
+    }
+
+    impl_uses_fpu = true;
+    printk("simd: using %s for bulk memory operations\n", name);
+}
+
+void copy_page(void* dst, const void* src)
+{
+    bulk_copy(dst, src, PAGE_SIZE);
+}
+
+void clear_pages(void* dst, size_t count)
+{
+    size_t size = count * PAGE_SIZE;
+    if (!impl_uses_fpu || size < SIMD_MIN_SIZE)
+    {
+        clear_scalar(dst, size);
+        return;
+    }
+
+    for (size_t done = 0; done < size; done += SIMD_REGION_SIZE)
+    {
+        size_t chunk = size - done < SIMD_REGION_SIZE ? size - done : SIMD_REGION_SIZE;
+
+        kernel_fpu_begin();
+        clear_impl((uint8_t*)dst + done, chunk);
+        kernel_fpu_end();
+    }
+}
+
+void bulk_copy(void* dst, const void* src, size_t size)
+{
+    if (!impl_uses_fpu || size < SIMD_MIN_SIZE)
+    {
+        copy_scalar(dst, src, size);
+        return;
+    }
+
+    size_t blocks_size = size & ~(size_t)(SIMD_BLOCK_SIZE - 1);
+    for (size_t done = 0; done < blocks_size; done += SIMD_REGION_SIZE)
+    {
+        size_t chunk = blocks_size - done < SIMD_REGION_SIZE ? blocks_size - done : SIMD_REGION_SIZE;
+
+        kernel_fpu_begin();
+        copy_impl((uint8_t*)dst + done, (const uint8_t*)src + done, chunk);
+        kernel_fpu_end();
+    }
+
+    copy_scalar((uint8_t*)dst + blocks_size, (const uint8_t*)src + blocks_size, size - blocks_size);
+}
+
+static void copy_scalar(void* dst, const void* src, size_t size)
+{
+    // Forward copy, safe for overlapping buffers if dst is below src
+    __asm__ volatile("cld; rep movsb" : "+D"(dst), "+S"(src), "+c"(size) : : "memory");
+}
+
+static void clear_scalar(void* dst, size_t size)
+{
+    size_t count = size / sizeof(uint64_t);
+    __asm__ volatile("cld; rep stosq" : "+D"(dst), "+c"(count) : "a"(0ull) : "memory");
+}
+
+static void copy_sse2(void* dst, const void* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += SIMD_BLOCK_SIZE)
+    {
+        __asm__ volatile(
+            "movdqu 0(%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movdqu %%xmm0, 0(%0)\n\t"
+            "movdqu %%xmm1, 16(%0)\n\t"
+            "movdqu %%xmm2, 32(%0)\n\t"
+            "movdqu %%xmm3, 48(%0)"
+            : : "r"((uint8_t*)dst + i), "r"((const uint8_t*)src + i) : "memory");
+    }
+}
+
+static void clear_sse2(void* dst, size_t size)
+{
+    __asm__ volatile("pxor %%xmm0, %%xmm0" : : );
+    for (size_t i = 0; i < size; i += SIMD_BLOCK_SIZE)
+    {
+        __asm__ volatile(
+            "movdqa %%xmm0, 0(%0)\n\t"
+            "movdqa %%xmm0, 16(%0)\n\t"
+            "movdqa %%xmm0, 32(%0)\n\t"
+            "movdqa %%xmm0, 48(%0)"
+            : : "r"((uint8_t*)dst + i) : "memory");
+    }
+}
+
+static void copy_avx2(void* dst, const void* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += SIMD_BLOCK_SIZE)
+    {
+        __asm__ volatile(
+            "vmovdqu 0(%1), %%ymm0\n\t"
+            "vmovdqu 32(%1), %%ymm1\n\t"
+            "vmovdqu %%ymm0, 0(%0)\n\t"
+            "vmovdqu %%ymm1, 32(%0)"
+            : : "r"((uint8_t*)dst + i), "r"((const uint8_t*)src + i) : "memory");
+    }
+    __asm__ volatile("vzeroupper");
+}
+
+static void clear_avx2(void* dst, size_t size)
+{
+    __asm__ volatile("vpxor %%ymm0, %%ymm0, %%ymm0" : : );
+    for (size_t i = 0; i < size; i += SIMD_BLOCK_SIZE)
+    {
+        __asm__ volatile(
+            "vmovdqa %%ymm0, 0(%0)\n\t"
+            "vmovdqa %%ymm0, 32(%0)"
+            : : "r"((uint8_t*)dst + i) : "memory");
+    }
+    __asm__ volatile("vzeroupper");
+}
+
+static void copy_avx512(void* dst, const void* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += SIMD_BLOCK_SIZE)
+    {
+        __asm__ volatile(
+            "vmovdqu64 (%1), %%zmm0\n\t"
+            "vmovdqu64 %%zmm0, (%0)"
+            : : "r"((uint8_t*)dst + i), "r"((const uint8_t*)src + i) : "memory");
+    }
+    __asm__ volatile("vzeroupper");
+}
+
+static void clear_avx512(void* dst, size_t size)
+{
+    __asm__ volatile("vpxorq %%zmm0, %%zmm0, %%zmm0" : : );
+    for (size_t i = 0; i < size; i += SIMD_BLOCK_SIZE)
+        __asm__ volatile("vmovdqa64 %%zmm0, (%0)" : : "r"((uint8_t*)dst + i) : "memory");
+
+    __asm__ volatile("vzeroupper");
+}
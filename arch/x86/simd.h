@@ -0,0 +1,39 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "common.h"
+
+/**
+ * Selects the widest SIMD implementation of bulk memory operations supported by CPU. 
+ * Scalar string instructions are used until then. 
+ * Requires fpu_init
+ */
+void simd_init();
+
+/**
+ * Copies a page
+ * 
+ * \param dst Destination, page aligned
+ * \param src Source, page aligned
+ */
+void copy_page(void* dst, const void* src);
+
+/**
+ * Fills pages with zeroes
+ * 
+ * \param dst First page, page aligned
+ * \param count Amount of pages
+ */
+void clear_pages(void* dst, size_t count);
+
+/**
+ * Copies large buffer, e.g. framebuffer contents. 
+ * Buffers may overlap if dst is below src
+ * 
+ * \param dst Destination
+ * \param src Source
+ * \param size Size in bytes
+ */
+void bulk_copy(void* dst, const void* src, size_t size);
+
+#endif
@@ -1,5 +1,6 @@
-extern _current
 extern do_syscall
+extern syscall_fast_table
+extern syscall_fast_count
 
 RPL_RING3: equ 3
 RPL_RING0: equ 0
@@ -9,6 +10,10 @@ KERNEL_DATA_SEG: equ (2 << 3) | RPL_RING0
 USER_DATA_SEG:   equ (3 << 3) | RPL_RING3
 USER_CODE_SEG:   equ (4 << 3) | RPL_RING3
 
+; percpu_t fields, must match arch/x86/percpu.h
+PERCPU_KSTACK_TOP:  equ 16
+PERCPU_RSP_SCRATCH: equ 24
+
 %macro PUSH_REGS 0
     push rax
     push rbx
@@ -51,10 +56,6 @@ USER_CODE_SEG:   equ (4 << 3) | RPL_RING3
 %endif
 %endmacro
 
-section .bss
-    rsp_scratch_space:
-        resb 8
-
 ; This is an entry point for syscall instruction.
 ; On enter, following holds:
 ;   rax contains syscall number;
@@ -63,24 +64,57 @@ section .bss
 ;   r11 contains userspace rflags;
 ;   rsp contains *userspace* stack (it may be corrupted or not mapped);
 ;   interrupts are disabled (IF set in IA32_FMASK).
-section .text
+section .text.hot progbits alloc exec nowrite align=16
     global syscall_entry
     syscall_entry:
         ; We cannot use user-controlled rsp here:
         ; No stack switch will be performed if exception or interrupt occurs here since we are already in ring0.
         ; So, invalid rsp leads us to the double fault.
-        mov qword [rsp_scratch_space], rsp
-        ; rsp = _current->arch_thread.kstack_top
-        mov rsp, qword [_current]
-        mov rsp, qword [rsp]
+        ; GS base points to per-CPU area after swapgs.
+        swapgs
+        mov qword [gs:PERCPU_RSP_SCRATCH], rsp
+        mov rsp, qword [gs:PERCPU_KSTACK_TOP]
+
+        ; Syscalls from syscall_fast_table don't need arch_regs_t and are called right away.
+        cmp rax, qword [syscall_fast_count]
+        jae .full_frame
+        cmp qword [syscall_fast_table + rax * 8], 0
+        je .full_frame
+
+        ; Save user registers that C code may clobber, except rax holding the return value.
+        ; Interrupts stay disabled.
+        push rcx
+        push r11
+        push rdi
+        push rsi
+        push rdx
+        push r8
+        push r9
+        push r10
+
+        ; Arguments are already in rdi, rsi, rdx
+        call qword [syscall_fast_table + rax * 8]
+
+        pop r10
+        pop r9
+        pop r8
+        pop rdx
+        pop rsi
+        pop rdi
+        pop r11
+        pop rcx
+        mov rsp, qword [gs:PERCPU_RSP_SCRATCH]
+        swapgs
+        o64 sysret
 
+    .full_frame:
         ; We have a reliable stack now
 
         ; Save task state (arch_regs_t) on the stack
         ; ss
         push qword USER_DATA_SEG
         ; rsp
-        push qword [rsp_scratch_space]
+        push qword [gs:PERCPU_RSP_SCRATCH]
         ; rflags
         push r11
         ; cs
@@ -118,6 +152,8 @@ section .text
         cli
         ; Restore user stack
         mov rsp, qword [rsp]
+        ; Restore user GS base
+        swapgs
         ; Return to user task
         o64 sysret
 
@@ -127,5 +163,7 @@ section .text
         POP_REGS
         ; Skip error code and IRQ number
         add rsp, 16
+        ; Restore user GS base
+        swapgs
         ; Jump to user task
         iretq
@@ -4,14 +4,22 @@
 #include <arch/x86/msr.h>
 #include <arch/x86/arch.h>
 #include <arch/x86/irq.h>
+#include <arch/x86/fpu.h>
+#include <arch/x86/simd.h>
 #include <mm/paging.h>
 #include <mm/frame_alloc.h>
+#include <mm/kstack.h>
 #include <kernel/irq.h>
 #include <kernel/panic.h>
 #include <sched/sched.h>
 
 static x86_tss_t tss;
 
+static percpu_t percpu_areas[MAX_CPU_COUNT] = {};
+
+static uint8_t irq_stacks[MAX_CPU_COUNT][IRQ_STACK_SIZE] __attribute__((aligned(16)));
+static uint8_t ist_stacks[MAX_CPU_COUNT][IST_COUNT][IST_STACK_SIZE] __attribute__((aligned(16)));
+
 typedef struct x86_gdt_descriptor
 {
     uint32_t dw0;
@@ -65,6 +73,12 @@ static void gdt_init()
 
 static void load_tss()
 {
+    // IST entries are numbered from 1
+    uint8_t (*ist)[IST_STACK_SIZE] = ist_stacks[arch_cpu_index()];
+    tss.ist1 = (uint64_t)(ist[IST_DF - 1] + IST_STACK_SIZE);
+    tss.ist2 = (uint64_t)(ist[IST_NMI - 1] + IST_STACK_SIZE);
+    tss.ist3 = (uint64_t)(ist[IST_MC - 1] + IST_STACK_SIZE);
+
     __asm__ volatile (
         "mov %0, %%ax\n"
         "ltr %%ax\n"
@@ -99,6 +113,20 @@ static void syscall_init()
     x86_wrmsr(IA32_STAR, star);
 }
 
+void percpu_init(uint32_t cpu_index)
+{
+    kassert(cpu_index < MAX_CPU_COUNT);
+
+    percpu_t* area = &percpu_areas[cpu_index];
+    area->self = area;
+    area->cpu_index = cpu_index;
+    area->irq_stack_top = irq_stacks[cpu_index] + IRQ_STACK_SIZE;
+
+    x86_wrmsr(IA32_GS_BASE, (uint64_t)area);
+    // User GS base, swapgs exchanges it with the kernel one
+    x86_wrmsr(IA32_KERNEL_GS_BASE, 0);
+}
+
 extern void irq_init();
 
 extern pml4_t early_pml4;
@@ -113,27 +141,31 @@ static void unmap_early()
 void arch_init()
 {
     unmap_early();
+    percpu_init(0);
     // After entering higher-half code, GDT needs to be relocated as well.
     gdt_init();
     load_tss();
     syscall_init();
     irq_init();
+    fpu_init();
 }
 
 void arch_thread_switch(arch_thread_t* prev, arch_thread_t* next)
 {
     tss.rsp0 = (uint64_t)next->kstack_top;
+    percpu_write(kstack_top, next->kstack_top);
+    fpu_switch_to(next);
     context_switch(&prev->context, &next->context);
 }
 
 static int allocate_kstack(arch_thread_t* th)
 {
-    th->kstack_top = frame_alloc();
+    th->kstack_top = kstack_alloc();
     if (th->kstack_top == NULL)
         return -ENOMEM;
     
-    memset(th->kstack_top, 0, PAGE_SIZE);
-    th->kstack_top += PAGE_SIZE;
+    // Stack may come from the cache, initial frames expect zeroed top page
+    clear_pages(th->kstack_top - PAGE_SIZE, 1);
     return 0;
 }
 
@@ -146,6 +178,13 @@ int arch_thread_new(arch_thread_t* th, arch_regs_t** result_regs)
     if (err < 0)
         return err;
 
+    err = fpu_thread_init(th);
+    if (err < 0)
+    {
+        kstack_free(th->kstack_top);
+        return err;
+    }
+
     uint8_t* kstack_top = th->kstack_top;
     kstack_top -= sizeof(arch_regs_t);
     arch_regs_t* regs = (arch_regs_t*)kstack_top;
@@ -174,6 +213,13 @@ int arch_thread_clone_current(arch_thread_t* dst, arch_regs_t** regs)
     if (err < 0)
         return err;
 
+    err = fpu_thread_clone(dst, src);
+    if (err < 0)
+    {
+        arch_thread_destroy(dst);
+        return err;
+    }
+
     // Copy arch_regs_t from src's kstack
     dst->context.rsp = (uint64_t)(dst->kstack_top - sizeof(arch_regs_t));
     memcpy((void*)dst->context.rsp, src->kstack_top - sizeof(arch_regs_t), sizeof(arch_regs_t));
@@ -189,5 +235,6 @@ int arch_thread_clone_current(arch_thread_t* dst, arch_regs_t** regs)
 
 void arch_thread_destroy(arch_thread_t* th)
 {
-    frame_free(th->kstack_top - PAGE_SIZE);
+    fpu_thread_destroy(th);
+    kstack_free(th->kstack_top);
 }
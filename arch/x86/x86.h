@@ -5,6 +5,15 @@
 
 #define RFLAGS_IF (1<<9)
 
+#define CR0_MP (1<<1)
+#define CR0_EM (1<<2)
+#define CR0_TS (1<<3)
+#define CR0_NE (1<<5)
+
+#define CR4_OSFXSR     (1<<9)
+#define CR4_OSXMMEXCPT (1<<10)
+#define CR4_OSXSAVE    (1<<18)
+
 static inline uint64_t x86_read_cr2()
 {
     uint64_t ret;
@@ -29,6 +38,41 @@ static inline uint8_t x86_inb(uint16_t port)
     return ret;
 }
 
+static inline uint64_t x86_read_cr0()
+{
+    uint64_t ret;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(ret));
+    return ret;
+}
+
+static inline void x86_write_cr0(uint64_t x)
+{
+    __asm__ volatile("mov %0, %%cr0" : : "r"(x));
+}
+
+static inline uint64_t x86_read_cr4()
+{
+    uint64_t ret;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(ret));
+    return ret;
+}
+
+static inline void x86_write_cr4(uint64_t x)
+{
+    __asm__ volatile("mov %0, %%cr4" : : "r"(x));
+}
+
+// Clears CR0.TS, so FPU instructions don't raise #NM
+static inline void x86_clts()
+{
+    __asm__ volatile("clts");
+}
+
+static inline void x86_xsetbv(uint32_t xcr, uint64_t x)
+{
+    __asm__ volatile("xsetbv" : : "c"(xcr), "a"((uint32_t)x), "d"((uint32_t)(x >> 32)));
+}
+
 static inline uint64_t x86_read_cr3()
 {
     uint64_t ret;
@@ -48,6 +92,44 @@ static inline void x86_write_cr3(uint64_t x)
     );
 }
 
+static inline void x86_invlpg(void* addr)
+{
+    __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Reads TSC after all preceding instructions have completed, use it to start measurement
+static inline uint64_t x86_rdtsc()
+{
+    uint32_t lo, hi;
+    __asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Reads TSC before any following instruction starts, use it to stop measurement
+static inline uint64_t x86_rdtscp()
+{
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtscp; lfence" : "=a"(lo), "=d"(hi) : : "rcx", "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+typedef struct x86_cpuid_regs
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+} x86_cpuid_regs_t;
+
+static inline x86_cpuid_regs_t x86_cpuid(uint32_t leaf, uint32_t subleaf)
+{
+    x86_cpuid_regs_t regs;
+    __asm__ volatile ("cpuid"
+        : "=a"(regs.eax), "=b"(regs.ebx), "=c"(regs.ecx), "=d"(regs.edx)
+        : "a"(leaf), "c"(subleaf));
+    return regs;
+}
+
 static inline void x86_hlt()
 {
     __asm__ volatile ("hlt");
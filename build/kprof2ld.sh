@@ -0,0 +1,19 @@
+#!/bin/bash
+# Turns "kprof: <address> <count>" lines from the kernel log into linker.ld fragment
+# listing the sampled functions from the hottest to the coldest.
+# Usage: kprof2ld.sh <kernel log> <kernel.sym>
+
+set -eo pipefail
+
+ADDR2LINE=${ADDR2LINE:-x86_64-elf-addr2line}
+
+samples=$(tr -d '\r' < "$1" | grep '^kprof: 0x' || true)
+if [ -z "$samples" ]; then
+    echo "kprof2ld: no samples in $1" >&2
+    exit 1
+fi
+
+paste <(cut -d' ' -f3 <<< "$samples") <(cut -d' ' -f2 <<< "$samples" | $ADDR2LINE -f -e "$2" | paste - -) \
+    | awk -F'\t' '$2 != "??" { hits[$2] += $1 } END { for (fn in hits) print hits[fn], fn }' \
+    | sort -rn \
+    | awk '{ printf "        *(.text.hot.%s .text.hot.%s.* .text.%s .text.%s.*)\n", $2, $2, $2, $2 }'
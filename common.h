@@ -37,6 +37,10 @@
 
 #define UNUSED(x) (void)(x)
 
+// Code placement hints: linker.ld puts hot functions together and moves cold ones out of the way
+#define __hot __attribute__((hot))
+#define __cold __attribute__((cold))
+
 // Error codes
 
 #define ENOSYS 1
@@ -1,16 +1,16 @@
 #include <drivers/apic.h>
 #include <kernel/panic.h>
 #include <kernel/irq.h>
+#include <kernel/printk.h>
 #include <arch/x86/x86.h>
+#include <arch/x86/msr.h>
 #include <mm/paging.h>
-#include <sched/sched.h>
-
-// APIC timer period in milliseconds
-#define APIC_TIMER_PERIOD SCHED_TIMER_PERIOD
 
 // APIC callibration period in milliseconds
 #define CALLIBRATE_PERIOD 10
 
+#define CPUID_1_ECX_X2APIC (1 << 21)
+
 // APIC
 
 #define TYPE_LAPIC          0
@@ -92,13 +92,26 @@ typedef struct __attribute__((packed)) madt_header
 volatile uint32_t* lapic_ptr = NULL;
 volatile ioapic_t* ioapic_ptr = NULL;
 
+// Local APIC registers are accessed through MSRs instead of lapic_ptr
+static bool x2apic = false;
+
+// Frequencies measured by apic_setup_timer, in Hz
+static uint64_t cpu_bus_freq = 0;
+static uint64_t pit_tsc_freq = 0;
+
 static void lapic_write(size_t idx, uint32_t value)
 {
-    lapic_ptr[idx / 4] = value;
+    if (x2apic)
+        x86_wrmsr(IA32_X2APIC_BASE + idx / 16, value);
+    else
+        lapic_ptr[idx / 4] = value;
 }
 
 static uint32_t lapic_read(size_t idx)
 {
+    if (x2apic)
+        return x86_rdmsr(IA32_X2APIC_BASE + idx / 16);
+
     return lapic_ptr[idx / 4];
 }
 
@@ -153,6 +166,24 @@ void apic_init()
     x86_outb(0x20 + 1, 0xFF);
     x86_outb(0xA0 + 1, 0xFF);
 
+    // Firmware may leave APIC globally disabled, going from there straight to x2APIC raises #GP
+    uint64_t apic_base = x86_rdmsr(IA32_APIC_BASE);
+    if (!(apic_base & IA32_APIC_BASE_ENABLE))
+    {
+        apic_base |= IA32_APIC_BASE_ENABLE;
+        x86_wrmsr(IA32_APIC_BASE, apic_base);
+    }
+
+    // Switch enabled xAPIC to x2APIC mode if it's supported, it has no MMIO registers
+    if (x86_cpuid(1, 0).ecx & CPUID_1_ECX_X2APIC)
+    {
+        if (!(apic_base & IA32_APIC_BASE_X2APIC))
+            x86_wrmsr(IA32_APIC_BASE, apic_base | IA32_APIC_BASE_X2APIC);
+        x2apic = true;
+    }
+
+    printk("apic: %s mode\n", x2apic ? "x2APIC" : "xAPIC");
+
     // Enable APIC, by setting spurious interrupt vector and APIC Software Enabled/Disabled flag.
     lapic_write(APIC_SPURIOUS, IRQ_SPURIOUS | APIC_SW_ENABLE);
 
@@ -195,26 +226,72 @@ void apic_setup_timer()
     // PIT is counting now
     // Reset APIC timer counter
     lapic_write(APIC_TMRINITCNT, -1);
+    uint64_t tsc_start = x86_rdtsc();
     // Wait PIT gate to be high
 #ifndef QEMU_PIT_HACK
     while (!(x86_inb(PIT_GATE) & CMD_CH2_OUT));
 #else
     while (x86_inb(PIT_GATE) & CMD_CH2_OUT);
 #endif
+    uint64_t tsc_end = x86_rdtscp();
     // Disable APIC timer
     lapic_write(APIC_LVT_TMR, APIC_DISABLE);
 
     // ---- Measure end
 
-    uint64_t cpu_bus_freq = (uint64_t)((uint32_t)(-1) - lapic_read(APIC_TMRCURRCNT)) * 1000 / CALLIBRATE_PERIOD;
+    cpu_bus_freq = (uint64_t)((uint32_t)(-1) - lapic_read(APIC_TMRCURRCNT)) * 1000 / CALLIBRATE_PERIOD;
+    pit_tsc_freq = (tsc_end - tsc_start) * 1000 / CALLIBRATE_PERIOD;
+}
+
+void apic_timer_oneshot(uint64_t ns)
+{
+    kassert_dbg(cpu_bus_freq != 0);
+
+    // Longer delays don't fit the 32-bit counter anyway, this keeps the product below from overflowing
+    if (ns > 1000000000)
+        ns = 1000000000;
+
+    uint64_t count = ns * cpu_bus_freq / 1000000000;
+    if (count == 0)
+        count = 1;
+    else if (count > (uint32_t)(-1))
+        count = (uint32_t)(-1);
 
-    // Final APIC timer setup using calculated CPU bus frequency
-    lapic_write(APIC_TMRINITCNT, cpu_bus_freq * APIC_TIMER_PERIOD / 1000);
     lapic_write(APIC_TMRDIV, TMR_DIV_X1);
-    lapic_write(APIC_LVT_TMR, IRQ_TIMER | TMR_PERIODIC);
+    lapic_write(APIC_LVT_TMR, IRQ_TIMER);
+    lapic_write(APIC_TMRINITCNT, count);
+}
+
+uint64_t apic_tsc_freq()
+{
+    return pit_tsc_freq;
 }
 
 void apic_eoi()
 {
     lapic_write(APIC_EOI, 0);
 }
+
+void apic_send_ipi(uint32_t dest, uint8_t vector)
+{
+    // x2APIC ICR is a single 64-bit register with 32-bit destination, the write sends IPI
+    if (x2apic)
+    {
+        x86_wrmsr(IA32_X2APIC_BASE + APIC_ICRL / 16, ((uint64_t)dest << 32) | vector);
+        return;
+    }
+
+    // Previous IPI must be accepted before ICR is rewritten, writing the low half sends IPI
+    while (lapic_read(APIC_ICRL) & APIC_DELIVS);
+    lapic_write(APIC_ICRH, dest << 24);
+    lapic_write(APIC_ICRL, vector);
+}
+
+uint32_t apic_id()
+{
+    // x2APIC ID takes the whole register
+    if (x2apic)
+        return lapic_read(APIC_ID);
+
+    return lapic_read(APIC_ID) >> 24;
+}
@@ -10,14 +10,40 @@
 void apic_init();
 
 /**
- * Initializes APIC timer
+ * Calibrates APIC timer and TSC against PIT. 
+ * Timer stays disabled until it's armed by apic_timer_oneshot
  */
 void apic_setup_timer();
 
+/**
+ * Arms APIC timer to fire IRQ_TIMER once
+ * 
+ * \param ns Delay in nanoseconds, it's clamped to the timer range
+ */
+void apic_timer_oneshot(uint64_t ns);
+
+/**
+ * \return TSC frequency in Hz measured while calibrating APIC timer
+ */
+uint64_t apic_tsc_freq();
+
 /**
  * Signals end-of-interrupt to the APIC. 
  * Must be called before interrupt handler finishes.
  */
 void apic_eoi();
 
+/**
+ * Sends fixed interrupt to another CPU
+ * 
+ * \param dest Local APIC ID of the target CPU
+ * \param vector Interrupt vector
+ */
+void apic_send_ipi(uint32_t dest, uint8_t vector);
+
+/**
+ * \return Local APIC ID of the current CPU
+ */
+uint32_t apic_id();
+
 #endif
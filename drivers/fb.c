@@ -2,6 +2,7 @@
 #include "kernel/multiboot.h"
 #include "drivers/fb.h"
 #include "mm/paging.h"
+#include "arch/x86/simd.h"
 
 bool fb_initialized = false;
 
@@ -91,7 +92,7 @@ void fb_scroll_up(int height, fb_color_t color)
 {
     kassert(fb_initialized);
 
-    memmove(fb_addr, fb_addr + fb_pitch * height, fb_pitch * (fb_height - height));
+    bulk_copy(fb_addr, fb_addr + fb_pitch * height, fb_pitch * (fb_height - height));
     for (int y = fb_height - height; y < fb_height; y++)
         fb_put_rect_fragment(color, 0, y, fb_width);
 }
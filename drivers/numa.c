@@ -0,0 +1,249 @@
+#include "drivers/numa.h"
+#include "drivers/acpi.h"
+#include "drivers/apic.h"
+#include "arch/x86/percpu.h"
+#include "kernel/panic.h"
+
+#define MAX_NUMA_RANGES 32
+#define MAX_NUMA_CPUS   256
+
+#define SRAT_TYPE_LAPIC    0
+#define SRAT_TYPE_MEMORY   1
+#define SRAT_TYPE_X2APIC   2
+
+#define SRAT_ENABLED 1
+
+typedef struct __attribute__((packed)) srat_header
+{
+    acpi_sdt_header_t acpi;
+    uint32_t reserved1;
+    uint64_t reserved2;
+} srat_header_t;
+
+typedef struct __attribute__((packed)) srat_entry
+{
+    uint8_t type;
+    uint8_t length;
+} srat_entry_t;
+
+typedef struct __attribute__((packed)) srat_lapic
+{
+    srat_entry_t header;
+    uint8_t  domain_lo;
+    uint8_t  apic_id;
+    uint32_t flags;
+    uint8_t  sapic_eid;
+    uint8_t  domain_hi[3];
+    uint32_t clock_domain;
+} srat_lapic_t;
+
+typedef struct __attribute__((packed)) srat_memory
+{
+    srat_entry_t header;
+    uint32_t domain;
+    uint16_t reserved1;
+    uint64_t base_addr;
+    uint64_t length;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} srat_memory_t;
+
+typedef struct __attribute__((packed)) srat_x2apic
+{
+    srat_entry_t header;
+    uint16_t reserved1;
+    uint32_t domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} srat_x2apic_t;
+
+typedef struct __attribute__((packed)) slit_header
+{
+    acpi_sdt_header_t acpi;
+    uint64_t localities;
+    uint8_t  distances[0];
+} slit_header_t;
+
+typedef struct numa_range
+{
+    uint64_t start;
+    uint64_t end;
+    int node;
+} numa_range_t;
+
+static int nodes_count = 1;
+// Proximity domain of each node
+static uint32_t node_domains[MAX_NUMA_NODES] = {0};
+static uint8_t  node_distances[MAX_NUMA_NODES][MAX_NUMA_NODES] = {0};
+
+static numa_range_t ranges[MAX_NUMA_RANGES] = {0};
+static int ranges_count = 0;
+
+// Node of each CPU, indexed by APIC ID
+static uint8_t cpu_nodes[MAX_NUMA_CPUS] = {0};
+
+static int numa_domain_to_node(uint32_t domain);
+static void numa_parse_srat(srat_header_t *srat);
+static void numa_parse_slit(slit_header_t *slit);
+
+void numa_init()
+{
+    for (int i = 0; i < MAX_NUMA_NODES; i++)
+    {
+        for (int j = 0; j < MAX_NUMA_NODES; j++)
+            node_distances[i][j] = i == j ? NUMA_LOCAL_DISTANCE : 2 * NUMA_LOCAL_DISTANCE;
+    }
+
+    srat_header_t *srat = (srat_header_t*)acpi_lookup("SRAT");
+    if (srat == NULL)
+        return;
+
+    nodes_count = 0;
+    numa_parse_srat(srat);
+    if (nodes_count == 0)
+    {
+        // No enabled entries
+        nodes_count = 1;
+        return;
+    }
+
+    slit_header_t *slit = (slit_header_t*)acpi_lookup("SLIT");
+    if (slit != NULL)
+        numa_parse_slit(slit);
+
+    numa_cpu_init();
+    printk("NUMA: %d nodes, %d memory ranges\n", nodes_count, ranges_count);
+}
+
+void numa_cpu_init()
+{
+    // apic_id may be an MMIO read or rdmsr trapping to the hypervisor, allocations read the cached node
+    uint32_t id = apic_id();
+    percpu_write(numa_node, id < MAX_NUMA_CPUS ? cpu_nodes[id] : 0);
+}
+
+int numa_nodes_count()
+{
+    return nodes_count;
+}
+
+int numa_node_of_range(uint64_t addr, uint64_t *end)
+{
+    kassert_dbg(end != NULL);
+
+    int node = 0;
+    for (int i = 0; i < ranges_count; i++)
+    {
+        if (ranges[i].start <= addr && addr < ranges[i].end)
+        {
+            node = ranges[i].node;
+            if (ranges[i].end < *end)
+                *end = ranges[i].end;
+        }
+        else if (addr < ranges[i].start && ranges[i].start < *end)
+        {
+            // Range not described by SRAT stops at the next described one
+            *end = ranges[i].start;
+        }
+    }
+
+    return node;
+}
+
+int numa_current_node()
+{
+    return percpu_read(numa_node);
+}
+
+int numa_distance(int from, int to)
+{
+    kassert_dbg(from < nodes_count && to < nodes_count);
+    return node_distances[from][to];
+}
+
+static int numa_domain_to_node(uint32_t domain)
+{
+    for (int i = 0; i < nodes_count; i++)
+    {
+        if (node_domains[i] == domain)
+            return i;
+    }
+
+    if (nodes_count == MAX_NUMA_NODES)
+    {
+        printk("NUMA: too many proximity domains, domain %d is merged into node 0\n", domain);
+        return 0;
+    }
+
+    node_domains[nodes_count] = domain;
+    return nodes_count++;
+}
+
+static void numa_parse_srat(srat_header_t *srat)
+{
+    srat_entry_t *entry = (srat_entry_t*)(srat + 1);
+    while ((uint8_t*)entry < (uint8_t*)srat + srat->acpi.length && entry->length != 0)
+    {
+        switch (entry->type)
+        {
+        case SRAT_TYPE_LAPIC:
+        {
+            srat_lapic_t *lapic = (srat_lapic_t*)entry;
+            if (!(lapic->flags & SRAT_ENABLED))
+                break;
+
+            uint32_t domain = lapic->domain_lo | (lapic->domain_hi[0] << 8) |
+                              (lapic->domain_hi[1] << 16) | ((uint32_t)lapic->domain_hi[2] << 24);
+            cpu_nodes[lapic->apic_id] = numa_domain_to_node(domain);
+            break;
+        }
+
+        case SRAT_TYPE_X2APIC:
+        {
+            srat_x2apic_t *x2apic = (srat_x2apic_t*)entry;
+            if ((x2apic->flags & SRAT_ENABLED) && x2apic->x2apic_id < MAX_NUMA_CPUS)
+                cpu_nodes[x2apic->x2apic_id] = numa_domain_to_node(x2apic->domain);
+
+            break;
+        }
+
+        case SRAT_TYPE_MEMORY:
+        {
+            srat_memory_t *memory = (srat_memory_t*)entry;
+            if (!(memory->flags & SRAT_ENABLED) || memory->length == 0)
+                break;
+
+            if (ranges_count == MAX_NUMA_RANGES)
+            {
+                printk("NUMA: too many memory ranges, ignoring range at %p\n", memory->base_addr);
+                break;
+            }
+
+            ranges[ranges_count].start = memory->base_addr;
+            ranges[ranges_count].end   = memory->base_addr + memory->length;
+            ranges[ranges_count].node  = numa_domain_to_node(memory->domain);
+            ranges_count++;
+            break;
+        }
+        }
+
+        entry = (srat_entry_t*)((uint8_t*)entry + entry->length);
+    }
+}
+
+static void numa_parse_slit(slit_header_t *slit)
+{
+    for (int i = 0; i < nodes_count; i++)
+    {
+        for (int j = 0; j < nodes_count; j++)
+        {
+            if (node_domains[i] >= slit->localities || node_domains[j] >= slit->localities)
+                continue;
+
+            node_distances[i][j] = slit->distances[node_domains[i] * slit->localities + node_domains[j]];
+        }
+    }
+}
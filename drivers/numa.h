@@ -0,0 +1,50 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "common.h"
+
+#define MAX_NUMA_NODES 8
+
+// SLIT distance of a node to itself
+#define NUMA_LOCAL_DISTANCE 10
+
+/**
+ * Reads memory and processor affinity from ACPI SRAT and node distances from SLIT. 
+ * If tables are absent, whole system is considered to be a single node. 
+ * Requires ACPI to be initialized.
+ */
+void numa_init();
+
+/**
+ * Caches node of the calling CPU in its per-CPU area. 
+ * numa_init calls it for the boot CPU, other CPUs call it after percpu_init
+ */
+void numa_cpu_init();
+
+/**
+ * \return Amount of NUMA nodes
+ */
+int numa_nodes_count();
+
+/**
+ * Returns node which owns physical memory at specified address. 
+ * 
+ * \param addr Physical address
+ * \param end Upper bound of the range in question. 
+ * Clipped to the end of the part of the range owned by the same node
+ * 
+ * \return Node index
+ */
+int numa_node_of_range(uint64_t addr, uint64_t *end);
+
+/**
+ * \return Node of the current CPU
+ */
+int numa_current_node();
+
+/**
+ * \return Relative memory access cost between given nodes as reported by SLIT
+ */
+int numa_distance(int from, int to);
+
+#endif
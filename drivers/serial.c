@@ -0,0 +1,50 @@
+#include "drivers/serial.h"
+#include "arch/x86/x86.h"
+
+#define COM1_PORT 0x3f8
+
+#define UART_DATA        0
+#define UART_INT_ENABLE  1
+#define UART_DIVISOR_LO  0
+#define UART_DIVISOR_HI  1
+#define UART_FIFO_CTRL   2
+#define UART_LINE_CTRL   3
+#define UART_MODEM_CTRL  4
+#define UART_LINE_STATUS 5
+
+#define UART_LINE_CTRL_DLAB 0x80
+#define UART_LINE_CTRL_8N1  0x03
+// Enable and clear FIFOs, 14 bytes threshold
+#define UART_FIFO_ENABLE    0xc7
+// DTR and RTS
+#define UART_MODEM_READY    0x03
+#define UART_TX_EMPTY       0x20
+
+// 115200 baud
+#define UART_DIVISOR 1
+
+bool serial_initialized = false;
+
+void serial_init()
+{
+    x86_outb(COM1_PORT + UART_INT_ENABLE, 0);
+
+    x86_outb(COM1_PORT + UART_LINE_CTRL, UART_LINE_CTRL_DLAB);
+    x86_outb(COM1_PORT + UART_DIVISOR_LO, UART_DIVISOR & 0xff);
+    x86_outb(COM1_PORT + UART_DIVISOR_HI, UART_DIVISOR >> 8);
+    x86_outb(COM1_PORT + UART_LINE_CTRL, UART_LINE_CTRL_8N1);
+
+    x86_outb(COM1_PORT + UART_FIFO_CTRL, UART_FIFO_ENABLE);
+    x86_outb(COM1_PORT + UART_MODEM_CTRL, UART_MODEM_READY);
+
+    serial_initialized = true;
+}
+
+void serial_putchar(char c)
+{
+    if (c == '\n')
+        serial_putchar('\r');
+
+    while (!(x86_inb(COM1_PORT + UART_LINE_STATUS) & UART_TX_EMPTY));
+    x86_outb(COM1_PORT + UART_DATA, c);
+}
@@ -0,0 +1,20 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "common.h"
+
+extern bool serial_initialized;
+
+/**
+ * Initializes COM1 port (115200 baud, 8N1). Console output is mirrored to it
+ */
+void serial_init();
+
+/**
+ * Sends character to COM1 port. '\n' is sent as "\r\n"
+ * 
+ * \param c Character
+ */
+void serial_putchar(char c);
+
+#endif
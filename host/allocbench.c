@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "host/host.h"
+#include "mm/frame_alloc.h"
+#include "mm/kmalloc.h"
+#include "mm/meminfo.h"
+#include "mm/paging.h"
+
+// Allocator throughput and fragmentation benchmark. 
+// Usage: allocbench [memory size in MB] [iterations] [seed]
+//
+// Randomized frame allocator fuzzer, checks buddy bitmaps and free lists after every step. 
+// Usage: allocbench fuzz [memory size in MB] [iterations] [seed]
+
+#define SLOTS_COUNT   4096
+#define REPORTS_COUNT 10
+
+// Order of blocks which back 2MB huge pages
+#define HUGE_ORDER 9
+
+// Fuzzer keeps memory under pressure with fewer, larger allocations
+#define FUZZ_SLOTS_COUNT 128
+#define FUZZ_MAX_ORDER   8
+
+static void* slots[SLOTS_COUNT];
+static meminfo_t info;
+
+// Fuzzer shadow state, indexed by emulated physical page number
+static size_t   pages_count;
+static uint8_t* baseline_free;
+static uint8_t* shadow_used;
+static uint8_t* walk_free;
+// Order + 1 at the first page of every free block, 0 elsewhere
+static uint8_t* walk_order;
+static int8_t*  walk_pair_bit;
+static size_t   walk_pages;
+static size_t   walk_blocks[MEMINFO_MAX_ORDERS];
+
+static size_t fuzz_sizes[FUZZ_SLOTS_COUNT];
+static size_t fuzz_step;
+
+// Single user pages are mapped by these entries, so compaction can migrate them. 
+// Tags written into the pages show that migration copied their contents
+static pte_t fuzz_ptes[FUZZ_SLOTS_COUNT];
+static uint64_t fuzz_tags[FUZZ_SLOTS_COUNT];
+static size_t fuzz_migrations;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report_throughput(const char* name, size_t ops, double elapsed)
+{
+    printf("%-24s %10.0f ops/s %8.1f ns/op\n", name, ops / elapsed, elapsed * 1e9 / ops);
+}
+
+static void report_fragmentation(size_t iter)
+{
+    memset(&info, 0, sizeof(info));
+    frame_alloc_meminfo(&info);
+
+    // Free memory which can't back a huge page, the closer to 1 the worse
+    uint64_t huge_free = 0;
+    int largest_order = -1;
+    for (size_t i = 0; i < info.zones_count; i++)
+    {
+        for (int order = 0; order < MEMINFO_MAX_ORDERS; order++)
+        {
+            if (info.zones[i].free_blocks[order] == 0)
+                continue;
+
+            if (order >= HUGE_ORDER)
+                huge_free += info.zones[i].free_blocks[order] << order;
+
+            if (order > largest_order)
+                largest_order = order;
+        }
+    }
+
+    double unusable = info.free_pages ? 1.0 - (double)huge_free / info.free_pages : 0.0;
+    printf("%10zu iterations: %8lu free pages, largest order %2d, unusable for 2MB %.3f\n",
+           iter, info.free_pages, largest_order, unusable);
+}
+
+static void bench_frame_single(size_t iters)
+{
+    double start = now();
+    for (size_t i = 0; i < iters; i++)
+        frame_free(frame_alloc());
+
+    report_throughput("frame_alloc/frame_free", 2 * iters, now() - start);
+}
+
+static void bench_frame_mixed(size_t iters)
+{
+    size_t ops = 0;
+    size_t fails = 0;
+
+    double start = now();
+    for (size_t i = 0; i < iters; i++)
+    {
+        size_t slot = rand() % SLOTS_COUNT;
+        if (slots[slot] != NULL)
+        {
+            frames_free(slots[slot]);
+            slots[slot] = NULL;
+        }
+        else
+        {
+            // Mostly single user pages, some small kernel buffers and rare huge pages
+            int kind = rand() % 100;
+            if (kind < 70)
+                slots[slot] = frames_alloc_type(1, FRAME_TYPE_USER);
+            else if (kind < 98)
+                slots[slot] = frames_alloc_type(2 + rand() % 15, FRAME_TYPE_KERNEL);
+            else
+                slots[slot] = frames_alloc_type(1 << HUGE_ORDER, FRAME_TYPE_USER);
+
+            if (slots[slot] == NULL)
+                fails++;
+        }
+
+        ops++;
+        if ((i + 1) % (iters / REPORTS_COUNT) == 0)
+            report_fragmentation(i + 1);
+    }
+
+    report_throughput("frames_alloc mixed", ops, now() - start);
+    printf("%-24s %10zu\n", "failed allocations", fails);
+
+    for (size_t i = 0; i < SLOTS_COUNT; i++)
+    {
+        if (slots[i] != NULL)
+            frames_free(slots[i]);
+
+        slots[i] = NULL;
+    }
+}
+
+static void bench_kmalloc(size_t iters)
+{
+    double start = now();
+    for (size_t i = 0; i < iters; i++)
+    {
+        size_t slot = rand() % SLOTS_COUNT;
+        if (slots[slot] != NULL)
+        {
+            kfree(slots[slot]);
+            slots[slot] = NULL;
+        }
+        else
+            slots[slot] = kmalloc(8 + rand() % 1024);
+    }
+
+    report_throughput("kmalloc/kfree random", iters, now() - start);
+
+    for (size_t i = 0; i < SLOTS_COUNT; i++)
+    {
+        kfree(slots[i]);
+        slots[i] = NULL;
+    }
+
+    // Same size in a tight loop exercises the magazines fast path
+    start = now();
+    for (size_t i = 0; i < iters; i++)
+        kfree(kmalloc(64));
+
+    report_throughput("kmalloc/kfree 64 bytes", 2 * iters, now() - start);
+}
+
+static size_t page_number(void* addr)
+{
+    return (uint64_t)VIRT_TO_PHYS(addr) / PAGE_SIZE;
+}
+
+static void fuzz_fail(const char* what, size_t page)
+{
+    fprintf(stderr, "fuzz: step %zu: %s at page 0x%zx\n", fuzz_step, what, page);
+    abort();
+}
+
+static void fuzz_visit(void* block, int order, int pair_bit, void* ctx)
+{
+    UNUSED(ctx);
+
+    size_t first = page_number(block);
+    size_t count = (size_t)1 << order;
+    if (first % count != 0)
+        fuzz_fail("misaligned free block", first);
+
+    if (first + count > pages_count || order >= MEMINFO_MAX_ORDERS)
+        fuzz_fail("free block outside of memory", first);
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        if (walk_free[i])
+            fuzz_fail("overlapping free blocks", i);
+
+        walk_free[i] = 1;
+    }
+
+    walk_order[first]    = order + 1;
+    walk_pair_bit[first] = pair_bit;
+    walk_pages += count;
+    walk_blocks[order]++;
+}
+
+static void fuzz_walk()
+{
+    memset(walk_free, 0, pages_count);
+    memset(walk_order, 0, pages_count);
+    memset(walk_blocks, 0, sizeof(walk_blocks));
+    walk_pages = 0;
+
+    frame_alloc_walk_free(fuzz_visit, NULL);
+}
+
+static void fuzz_check()
+{
+    fuzz_walk();
+
+    // Free lists hold exactly the pages which were free initially and aren't allocated now
+    for (size_t i = 0; i < pages_count; i++)
+    {
+        if (walk_free[i] != (baseline_free[i] && !shadow_used[i]))
+            fuzz_fail(walk_free[i] ? "allocated page in free lists" : "free page lost", i);
+    }
+
+    // Bit of a buddy pair is set iff exactly one of them is free as a whole
+    for (size_t i = 0; i < pages_count; i++)
+    {
+        if (walk_order[i] == 0 || walk_pair_bit[i] < 0)
+            continue;
+
+        int order = walk_order[i] - 1;
+        size_t buddy = i ^ ((size_t)1 << order);
+        bool buddy_free = buddy < pages_count && walk_order[buddy] == order + 1;
+        if (buddy_free)
+            fuzz_fail("free buddies are not coalesced", i);
+
+        if (walk_pair_bit[i] != 1)
+            fuzz_fail("buddy bitmap bit is clear for a free block with busy buddy", i);
+    }
+
+    memset(&info, 0, sizeof(info));
+    frame_alloc_meminfo(&info);
+    if (walk_pages != info.free_pages)
+        fuzz_fail("free pages counter doesn't match free lists", 0);
+
+    for (int order = 0; order < MEMINFO_MAX_ORDERS; order++)
+    {
+        uint64_t blocks = 0;
+        for (size_t i = 0; i < info.zones_count; i++)
+            blocks += info.zones[i].free_blocks[order];
+
+        if (blocks != walk_blocks[order])
+            fuzz_fail("free blocks counter doesn't match free lists", order);
+    }
+}
+
+static void fuzz_check_mappings()
+{
+    // Old frames are released first, destinations of migrations are free pages
+    for (size_t slot = 0; slot < FUZZ_SLOTS_COUNT; slot++)
+    {
+        if (fuzz_ptes[slot] != 0 && PTE_ADDR(fuzz_ptes[slot]) != VIRT_TO_PHYS(slots[slot]))
+            shadow_used[page_number(slots[slot])] = 0;
+    }
+
+    for (size_t slot = 0; slot < FUZZ_SLOTS_COUNT; slot++)
+    {
+        if (fuzz_ptes[slot] == 0)
+            continue;
+
+        pte_t pte = fuzz_ptes[slot];
+        if ((pte & PTE_FLAGS_MASK) != (PTE_PRESENT | PTE_WRITEABLE | PTE_USER | PTE_ALLOC))
+            fuzz_fail("mapping flags changed", page_number(slots[slot]));
+
+        uint64_t* frame = PHYS_TO_VIRT(PTE_ADDR(pte));
+        frame_t* desc = frame_desc(frame);
+        if (desc == NULL || desc->mapping != &fuzz_ptes[slot] || desc->pages != 1 ||
+            desc->type != FRAME_TYPE_USER || desc->refcount != 1)
+            fuzz_fail("wrong descriptor of mapped frame", page_number(frame));
+
+        if (frame[0] != fuzz_tags[slot] || frame[PAGE_SIZE / sizeof(uint64_t) - 1] != ~fuzz_tags[slot])
+            fuzz_fail("mapped frame contents lost", page_number(frame));
+
+        if ((void*)frame == slots[slot])
+            continue;
+
+        if (shadow_used[page_number(frame)] || !baseline_free[page_number(frame)])
+            fuzz_fail("frame migrated to a used page", page_number(frame));
+
+        shadow_used[page_number(frame)] = 1;
+        slots[slot] = frame;
+        fuzz_migrations++;
+    }
+}
+
+static void fuzz_alloc(size_t slot)
+{
+    // Exact power of two sizes, arbitrary sizes which return their tails and single pages
+    size_t pages;
+    int kind = rand() % 100;
+    if (kind < 40)
+        pages = (size_t)1 << (rand() % (FUZZ_MAX_ORDER + 1));
+    else if (kind < 80)
+        pages = 1 + rand() % ((1 << FUZZ_MAX_ORDER) - 1);
+    else if (kind < 98)
+        pages = 1;
+    else
+        pages = 1 << HUGE_ORDER;
+
+    // Both mobility types, so blocks are stolen between them
+    frame_type_t type = rand() % 2 ? FRAME_TYPE_USER : FRAME_TYPE_KERNEL;
+    void* block = frames_alloc_type(pages, type);
+
+    // Compaction may have moved mapped pages and reused their old frames
+    fuzz_check_mappings();
+    if (block == NULL)
+        return;
+
+    size_t first = page_number(block);
+    size_t align = 1;
+    while (align < pages)
+        align *= 2;
+
+    if (first % align != 0)
+        fuzz_fail("allocation is not aligned by its size", first);
+
+    frame_t* desc = frame_desc(block);
+    if (desc == NULL || desc->pages != pages || desc->type != type || desc->refcount != 1)
+        fuzz_fail("wrong descriptor of allocation", first);
+
+    for (size_t i = first; i < first + pages; i++)
+    {
+        if (shadow_used[i] || !baseline_free[i])
+            fuzz_fail("page allocated twice", i);
+
+        shadow_used[i] = 1;
+    }
+
+    slots[slot] = block;
+    fuzz_sizes[slot] = pages;
+
+    if (type == FRAME_TYPE_USER && pages == 1 && rand() % 10 != 0)
+    {
+        uint64_t* words = block;
+        fuzz_tags[slot] = (fuzz_step << 16) | slot;
+        words[0] = fuzz_tags[slot];
+        words[PAGE_SIZE / sizeof(uint64_t) - 1] = ~fuzz_tags[slot];
+
+        fuzz_ptes[slot] = (uint64_t)VIRT_TO_PHYS(block) | PTE_PRESENT | PTE_WRITEABLE | PTE_USER | PTE_ALLOC;
+        desc->mapping = &fuzz_ptes[slot];
+    }
+}
+
+
+static void fuzz_free(size_t slot)
+{
+    size_t first = page_number(slots[slot]);
+    for (size_t i = first; i < first + fuzz_sizes[slot]; i++)
+        shadow_used[i] = 0;
+
+    frames_free(slots[slot]);
+    slots[slot] = NULL;
+    fuzz_ptes[slot] = 0;
+}
+
+static void fuzz(size_t mem_size, size_t iters)
+{
+    pages_count   = mem_size / PAGE_SIZE;
+    baseline_free = calloc(pages_count, 1);
+    shadow_used   = calloc(pages_count, 1);
+    walk_free     = calloc(pages_count, 1);
+    walk_order    = calloc(pages_count, 1);
+    walk_pair_bit = calloc(pages_count, 1);
+    if (!baseline_free || !shadow_used || !walk_free || !walk_order || !walk_pair_bit)
+    {
+        perror("fuzz: calloc");
+        exit(1);
+    }
+
+    // Everything free right after initialization stays the reference
+    fuzz_walk();
+    memcpy(baseline_free, walk_free, pages_count);
+    size_t baseline_blocks[MEMINFO_MAX_ORDERS];
+    memcpy(baseline_blocks, walk_blocks, sizeof(walk_blocks));
+    fuzz_check();
+
+    size_t allocs = 0;
+    for (fuzz_step = 1; fuzz_step <= iters; fuzz_step++)
+    {
+        size_t slot = rand() % FUZZ_SLOTS_COUNT;
+        if (slots[slot] != NULL)
+            fuzz_free(slot);
+        else
+        {
+            fuzz_alloc(slot);
+            allocs += slots[slot] != NULL;
+        }
+
+        fuzz_check();
+    }
+
+    // Freeing everything must coalesce blocks back into the initial ones
+    for (size_t slot = 0; slot < FUZZ_SLOTS_COUNT; slot++)
+    {
+        if (slots[slot] != NULL)
+            fuzz_free(slot);
+    }
+
+    fuzz_check();
+    for (int order = 0; order < MEMINFO_MAX_ORDERS; order++)
+    {
+        if (walk_blocks[order] != baseline_blocks[order])
+            fuzz_fail("blocks are not coalesced after freeing everything", order);
+    }
+
+    printf("fuzz: %zu steps, %zu allocations, %zu migrations, all checks passed\n", iters, allocs, fuzz_migrations);
+}
+
+int main(int argc, char** argv)
+{
+    bool fuzz_mode = argc > 1 && strlen(argv[1]) == 4 && memcmp(argv[1], "fuzz", 4) == 0;
+    if (fuzz_mode)
+    {
+        argc--;
+        argv++;
+    }
+
+    size_t mem_size = (argc > 1 ? strtoull(argv[1], NULL, 0) : (fuzz_mode ? 16 : 1024)) * MB;
+    size_t iters    = argc > 2 ? strtoull(argv[2], NULL, 0) : (fuzz_mode ? 20000 : 1000000);
+    unsigned seed   = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+
+    if (iters < REPORTS_COUNT)
+        iters = REPORTS_COUNT;
+
+    host_setup_memory(mem_size);
+    frame_alloc_init();
+
+    srand(seed);
+    if (fuzz_mode)
+    {
+        fuzz(mem_size, iters);
+        return 0;
+    }
+
+    report_fragmentation(0);
+
+    bench_frame_single(iters);
+    bench_frame_mixed(iters);
+    bench_kmalloc(iters);
+
+    report_fragmentation(iters);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+
+// Host build has no per-CPU area behind GS, the benchmark is single-threaded
+
+#define MAX_CPU_COUNT 8
+
+typedef struct percpu
+{
+    int numa_node;
+} percpu_t;
+
+// Defined in host/stubs.c
+extern percpu_t host_percpu;
+
+#define percpu_read(field) (host_percpu.field)
+#define percpu_write(field, val) (host_percpu.field = (val))
+
+static inline uint32_t arch_cpu_index()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "common.h"
+
+// Host build has no kernel FPU regions, plain loops are used instead
+
+static inline void clear_pages(void* dst, size_t count)
+{
+    memset(dst, 0, count * PAGE_SIZE);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include "common.h"
+
+/**
+ * Creates emulated physical memory of specified size and a Multiboot memory map describing it. 
+ * Must be called before frame_alloc_init
+ * 
+ * \param mem_size Size in bytes
+ */
+void host_setup_memory(size_t mem_size);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef MEM_LAYOUT_H
+#define MEM_LAYOUT_H
+
+// Host replacement of mm/mem_layout.h. Direct physical mapping is emulated 
+// by an anonymous mapping at a fixed address of the user address space
+
+#define PAGE_SIZE 4096
+
+#define KERNEL_DIRECT_PHYS_MAPPING_START 0x200000000000
+#define KERNEL_DIRECT_PHYS_MAPPING_SIZE  (1ull << 40)
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "host/host.h"
+#include "arch/x86/percpu.h"
+#include "drivers/acpi.h"
+#include "kernel/multiboot.h"
+#include "kernel/panic.h"
+#include "mm/frame_alloc.h"
+#include "mm/paging.h"
+
+// Kernel facilities which frame_alloc.c, obj.c and numa.c depend on
+
+static struct __attribute__((packed))
+{
+    mb_memmap_info_t info;
+    mb_memmap_entry_t entries[2];
+} host_memmap;
+
+percpu_t host_percpu;
+
+void printk(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void __panic(const char* location, const char* fmt, ...)
+{
+    fprintf(stderr, "Kernel panic at %s: ", location);
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fprintf(stderr, "\n");
+    abort();
+}
+
+acpi_sdt_t* acpi_lookup(const char* signature)
+{
+    UNUSED(signature);
+    return NULL;
+}
+
+uint32_t apic_id()
+{
+    return 0;
+}
+
+bool vmem_migrate_frame(void* old_frame, void* new_frame)
+{
+    // Same as in mm/vmem.c, page table entries are plain words owned by the fuzzer
+    frame_t *old_desc = frame_desc(old_frame);
+    frame_t *new_desc = frame_desc(new_frame);
+    if (old_desc == NULL || new_desc == NULL)
+        panic("vmem_migrate_frame: unknown frame %p -> %p", old_frame, new_frame);
+
+    pte_t* pte = old_desc->mapping;
+    if (pte == NULL || !(*pte & PTE_PRESENT) || !(*pte & PTE_ALLOC) || PTE_ADDR(*pte) != VIRT_TO_PHYS(old_frame))
+        return false;
+
+    memcpy(new_frame, old_frame, PAGE_SIZE);
+    *pte = (uint64_t)VIRT_TO_PHYS(new_frame) | (*pte & PTE_FLAGS_MASK);
+    new_desc->mapping = pte;
+    old_desc->mapping = NULL;
+    return true;
+}
+
+void host_setup_memory(size_t mem_size)
+{
+    // Low memory and the rest of RAM, as reported by a typical BIOS
+    host_memmap.info.header.size  = sizeof(host_memmap);
+    host_memmap.info.entry_size   = sizeof(mb_memmap_entry_t);
+
+    host_memmap.entries[0].base_addr = 0;
+    host_memmap.entries[0].length    = 0x9fc00;
+    host_memmap.entries[0].type      = MB_MEMMAP_TYPE_RAM;
+
+    host_memmap.entries[1].base_addr = MB;
+    host_memmap.entries[1].length    = mem_size - MB;
+    host_memmap.entries[1].type      = MB_MEMMAP_TYPE_RAM;
+
+    mb_memmap_info = &host_memmap.info;
+
+    void *mem = mmap(PHYS_TO_VIRT(0), mem_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("host_setup_memory: mmap");
+        exit(1);
+    }
+}
@@ -1,5 +1,6 @@
 #include "kernel/panic.h"
 #include "kernel/console.h"
+#include "drivers/serial.h"
 
 static const int FONT_WIDTH  = 8;
 static const int FONT_HEIGHT = 8;
@@ -161,6 +162,9 @@ void cons_putchar_color(char c, fb_color_t fg_color, fb_color_t bg_color)
 {
     kassert(cons_initialized);
 
+    if (serial_initialized)
+        serial_putchar(c);
+
     switch (c)
     {
     case '\n':
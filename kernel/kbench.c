@@ -0,0 +1,149 @@
+#include "kernel/kbench.h"
+#include "kernel/panic.h"
+#include "kernel/kprof.h"
+#include "arch/x86/x86.h"
+#include "mm/frame_alloc.h"
+#include "mm/kmalloc.h"
+#include "mm/obj.h"
+#include "mm/vmem.h"
+
+// The whole suite, including sample storage, exists only in KBENCH builds
+#ifdef KBENCH
+
+typedef struct kbench_obj
+{
+    uint64_t data[8];
+} kbench_obj_t;
+
+static OBJ_ALLOC_DEFINE(kbench_obj_alloc, kbench_obj_t);
+
+static const char* kbench_names[KBENCH_COUNT] =
+{
+    [KBENCH_FRAME_ALLOC]   = "frame_alloc+frame_free",
+    [KBENCH_OBJECT_ALLOC]  = "object_alloc+object_free",
+    [KBENCH_KMALLOC]       = "kmalloc+kfree 128",
+    [KBENCH_VMEM_MAP_PAGE] = "vmem_map_page",
+    [KBENCH_PRINTK]        = "printk line",
+    [KBENCH_SYSCALL]       = "syscall getpid (fast path)",
+    [KBENCH_SYSCALL_FULL]  = "syscall getpid (full frame)",
+    [KBENCH_VDATA_GETPID]  = "getpid from vdata page",
+    [KBENCH_VDATA_CLOCK]   = "clock_gettime from vdata page",
+    [KBENCH_NANOSLEEP]     = "nanosleep(100us) round trip",
+    [KBENCH_RING]          = "ring_enter 16 x getpid",
+    [KBENCH_SCHED_YIELD]   = "sleep(0) round trip",
+    [KBENCH_FORK_WAIT]     = "fork+exit+wait",
+    [KBENCH_PAGE_FAULT]    = "page fault"
+};
+
+static uint64_t samples[KBENCH_COUNT][KBENCH_SAMPLES] = {0};
+static size_t samples_count[KBENCH_COUNT] = {0};
+
+static void kbench_report(kbench_id_t id);
+
+void kbench_run()
+{
+    printk("kbench: running kernel benchmarks\n");
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = x86_rdtsc();
+        frame_free(frame_alloc());
+        kbench_record(KBENCH_FRAME_ALLOC, x86_rdtscp() - start);
+    }
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = x86_rdtsc();
+        object_free(&kbench_obj_alloc, object_alloc(&kbench_obj_alloc));
+        kbench_record(KBENCH_OBJECT_ALLOC, x86_rdtscp() - start);
+    }
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = x86_rdtsc();
+        kfree(kmalloc(128));
+        kbench_record(KBENCH_KMALLOC, x86_rdtscp() - start);
+    }
+
+    vmem_t vm;
+    if (vmem_init(&vm) < 0)
+        panic("kbench: can't create address space");
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        // Same frame everywhere, it's not owned by the address space
+        uint64_t start = x86_rdtsc();
+        int err = vmem_map_page(&vm, (void*)(KBENCH_PF_AREA + i * PAGE_SIZE), (void*)0, VMEM_WRITE);
+        kbench_record(KBENCH_VMEM_MAP_PAGE, x86_rdtscp() - start);
+
+        if (err < 0)
+            panic("kbench: vmem_map_page failed: %i", err);
+    }
+
+    vmem_destroy(&vm);
+
+    for (size_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = x86_rdtsc();
+        printk("kbench: printk throughput line %d\n", i);
+        kbench_record(KBENCH_PRINTK, x86_rdtscp() - start);
+    }
+}
+
+void kbench_record(kbench_id_t id, uint64_t cycles)
+{
+    kassert(id < KBENCH_COUNT);
+
+    if (samples_count[id] < KBENCH_SAMPLES)
+        samples[id][samples_count[id]++] = cycles;
+}
+
+_Noreturn void kbench_finish()
+{
+    printk("kbench: results in TSC cycles\n");
+    for (int id = 0; id < KBENCH_COUNT; id++)
+        kbench_report(id);
+
+#ifdef KPROF
+    kprof_dump();
+#endif
+
+    printk("kbench: done\n");
+    x86_outb(KBENCH_EXIT_PORT, 0);
+
+    // Not running under QEMU with isa-debug-exit
+    x86_hlt_forever();
+}
+
+static void kbench_report(kbench_id_t id)
+{
+    size_t count = samples_count[id];
+    if (count == 0)
+    {
+        printk("kbench: %s: no samples\n", kbench_names[id]);
+        return;
+    }
+
+    uint64_t *values = samples[id];
+
+    // Insertion sort is fine for the small amount of samples
+    for (size_t i = 1; i < count; i++)
+    {
+        uint64_t curr = values[i];
+        size_t j = i;
+        for (; j > 0 && values[j - 1] > curr; j--)
+            values[j] = values[j - 1];
+
+        values[j] = curr;
+    }
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum += values[i];
+
+    printk("kbench: %s: mean %u p50 %u p90 %u p99 %u max %u\n", kbench_names[id],
+           (uint32_t)(sum / count), (uint32_t)values[count / 2], (uint32_t)values[count * 90 / 100],
+           (uint32_t)values[count * 99 / 100], (uint32_t)values[count - 1]);
+}
+
+#endif
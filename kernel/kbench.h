@@ -0,0 +1,61 @@
+#ifndef KBENCH_H
+#define KBENCH_H
+
+#include "common.h"
+
+// Samples taken for each benchmark
+#define KBENCH_SAMPLES 256
+
+// Operations submitted by a single SYS_RING_ENTER in the ring benchmark
+#define KBENCH_RING_BATCH 16
+
+// Lazily allocated area of the init task touched by the page fault benchmark
+#define KBENCH_PF_AREA 0x40000000
+
+// QEMU isa-debug-exit device port, QEMU exits with status (value << 1) | 1
+#define KBENCH_EXIT_PORT 0xf4
+
+typedef enum kbench_id
+{
+    KBENCH_FRAME_ALLOC = 0,
+    KBENCH_OBJECT_ALLOC,
+    KBENCH_KMALLOC,
+    KBENCH_VMEM_MAP_PAGE,
+    KBENCH_PRINTK,
+    // Measured by the user part of the suite
+    KBENCH_SYSCALL,
+    KBENCH_SYSCALL_FULL,
+    KBENCH_VDATA_GETPID,
+    KBENCH_VDATA_CLOCK,
+    KBENCH_NANOSLEEP,
+    KBENCH_RING,
+    KBENCH_SCHED_YIELD,
+    KBENCH_FORK_WAIT,
+    KBENCH_PAGE_FAULT,
+    KBENCH_COUNT
+} kbench_id_t;
+
+// SYS_KBENCH operations
+#define KBENCH_OP_RECORD 0
+#define KBENCH_OP_FINISH 1
+
+/**
+ * Runs kernel part of the benchmark suite. 
+ * User part is run by the init task when kernel is built with KBENCH
+ */
+void kbench_run();
+
+/**
+ * Records single sample of the benchmark
+ * 
+ * \param id Benchmark
+ * \param cycles Measured TSC cycles
+ */
+void kbench_record(kbench_id_t id, uint64_t cycles);
+
+/**
+ * Prints mean and percentiles of every benchmark and exits QEMU
+ */
+_Noreturn void kbench_finish();
+
+#endif
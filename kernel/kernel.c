@@ -4,15 +4,20 @@
 #include <kernel/printk.h>
 #include <kernel/panic.h>
 #include <kernel/irq.h>
+#include <kernel/kbench.h>
+#include <kernel/time.h>
 #include <drivers/fb.h>
+#include <arch/x86/simd.h>
 #include <drivers/acpi.h>
 #include <drivers/apic.h>
+#include <drivers/numa.h>
+#include <drivers/serial.h>
 #include <mm/paging.h>
 #include <mm/frame_alloc.h>
 #include <mm/vmem.h>
 #include <sched/sched.h>
 
-void dump_memmap()
+__cold void dump_memmap()
 {
     struct mb_memmap_iter memmap_iter;
     mb_memmap_iter_init(&memmap_iter);
@@ -57,15 +62,22 @@ void kmain(early_data_t *early_data)
     mb_parse_boot_info(early_data);
     fb_init(mb_fb_info);
     cons_init();
+    serial_init();
 
     printk("HeavenOS version %s\n", HEAVENOS_VERSION);
+    simd_init();
     acpi_init();
     apic_init();
     apic_setup_timer();
+    time_init();
+    numa_init();
 
     dump_memmap();
     frame_alloc_init();
 
+#ifdef KBENCH
+    kbench_run();
+#endif
 
     sched_start();
     panic("manually initiated %s", "panic");
@@ -0,0 +1,41 @@
+#include "kernel/kprof.h"
+#include "kernel/printk.h"
+
+typedef struct kprof_entry
+{
+    uint64_t rip;
+    uint32_t count;
+} kprof_entry_t;
+
+// Open addressing hash table of sampled addresses
+static kprof_entry_t entries[KPROF_MAX_ADDRS];
+static size_t dropped = 0;
+
+void kprof_sample(uint64_t rip)
+{
+    size_t idx = (rip * 0x9e3779b97f4a7c15ull) >> 32;
+    for (size_t i = 0; i < KPROF_MAX_ADDRS; i++)
+    {
+        kprof_entry_t *entry = &entries[(idx + i) & (KPROF_MAX_ADDRS - 1)];
+        if (entry->rip == rip || entry->rip == 0)
+        {
+            entry->rip = rip;
+            entry->count++;
+            return;
+        }
+    }
+
+    dropped++;
+}
+
+void kprof_dump()
+{
+    for (size_t i = 0; i < KPROF_MAX_ADDRS; i++)
+    {
+        if (entries[i].count > 0)
+            printk("kprof: %p %u\n", entries[i].rip, entries[i].count);
+    }
+
+    if (dropped > 0)
+        printk("kprof: %u samples dropped\n", dropped);
+}
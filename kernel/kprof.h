@@ -0,0 +1,22 @@
+#ifndef KPROF_H
+#define KPROF_H
+
+#include "common.h"
+
+// Distinct instruction addresses tracked by the profiler, must be a power of two
+#define KPROF_MAX_ADDRS 4096
+
+/**
+ * Records a sample of the kernel code being executed. 
+ * Called from the timer interrupt when kernel is built with KPROF
+ * \param rip Interrupted instruction address
+ */
+void kprof_sample(uint64_t rip);
+
+/**
+ * Prints collected samples as "kprof: <address> <count>" lines. 
+ * build/kprof2ld.sh turns them into the ordered hot functions list for linker.ld
+ */
+void kprof_dump();
+
+#endif
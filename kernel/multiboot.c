@@ -9,18 +9,28 @@
 #define MB_TAG_RSDP_V1 14
 #define MB_TAG_RSDP_V2 15
 
-// To be filled by entry point code
-static uint8_t *mb_boot_info;
+// Boot info tags which are used after mb_parse_boot_info are copied here,
+// so memory occupied by the boot info itself can be handed to the frame allocator
+#define MB_MEMMAP_COPY_SIZE 4096
+#define MB_RSDP_COPY_SIZE   64
+
+static mb_fb_info_t mb_fb_info_copy;
+static uint8_t mb_memmap_copy[MB_MEMMAP_COPY_SIZE] __attribute__((aligned(MB_TAG_ALIGNMENT)));
+static uint8_t mb_rsdp_v1_copy[MB_RSDP_COPY_SIZE] __attribute__((aligned(MB_TAG_ALIGNMENT)));
+static uint8_t mb_rsdp_v2_copy[MB_RSDP_COPY_SIZE] __attribute__((aligned(MB_TAG_ALIGNMENT)));
 
 mb_fb_info_t     *mb_fb_info      = NULL;
 mb_memmap_info_t *mb_memmap_info  = NULL;
 mb_rsdp_t        *mb_acpi_rsdp_v1 = NULL;
 mb_rsdp_t        *mb_acpi_rsdp_v2 = NULL;
 
+static void *mb_copy_tag(mb_tag_header_t *tag, void *dst, size_t dst_size);
+static mb_memmap_info_t *mb_copy_memmap(mb_memmap_info_t *memmap);
+
 void mb_parse_boot_info(early_data_t *early_data)
 {
     kassert(early_data != NULL);
-    mb_boot_info = early_data->multiboot_info;
+    uint8_t *mb_boot_info = early_data->multiboot_info;
 
     // Skip fixed part
     uint8_t *iter = mb_boot_info + sizeof(mb_boot_info_header_t);
@@ -40,22 +50,22 @@ void mb_parse_boot_info(early_data_t *early_data)
 
         case MB_TAG_MEMMAP:
             // Memory map
-            mb_memmap_info = (mb_memmap_info_t*)curr_tag;
+            mb_memmap_info = mb_copy_memmap((mb_memmap_info_t*)curr_tag);
             break;
 
         case MB_TAG_FB:
             // Framebuffer
-            mb_fb_info = (mb_fb_info_t*)curr_tag;
+            mb_fb_info = mb_copy_tag(curr_tag, &mb_fb_info_copy, sizeof(mb_fb_info_copy));
             break;
 
         case MB_TAG_RSDP_V1:
             // ACPI 1.0 RSDP
-            mb_acpi_rsdp_v1 = (mb_rsdp_t*)curr_tag;
+            mb_acpi_rsdp_v1 = mb_copy_tag(curr_tag, mb_rsdp_v1_copy, sizeof(mb_rsdp_v1_copy));
             break;
 
         case MB_TAG_RSDP_V2:
             // ACPI 2.0 RSDP
-            mb_acpi_rsdp_v2 = (mb_rsdp_t*)curr_tag;
+            mb_acpi_rsdp_v2 = mb_copy_tag(curr_tag, mb_rsdp_v2_copy, sizeof(mb_rsdp_v2_copy));
             break;
         }
 
@@ -83,13 +93,28 @@ mb_memmap_entry_t *mb_memmap_iter_next(mb_memmap_iter_t *it)
     return ret;
 }
 
-mem_region_t mb_memory_region()
+static void *mb_copy_tag(mb_tag_header_t *tag, void *dst, size_t dst_size)
 {
-    mem_region_t res =
-    {
-        .start = mb_boot_info,
-        .end   = mb_boot_info + ALIGN_UP(((mb_boot_info_header_t*)mb_boot_info)->total_size, PAGE_SIZE),
-    };
-    
-    return res;
+    kassert_dbg(tag != NULL && dst != NULL);
+
+    size_t size = tag->size < dst_size ? tag->size : dst_size;
+    memcpy(dst, tag, size);
+    ((mb_tag_header_t*)dst)->size = size;
+    return dst;
+}
+
+static mb_memmap_info_t *mb_copy_memmap(mb_memmap_info_t *memmap)
+{
+    kassert_dbg(memmap != NULL);
+
+    // Truncate to whole entries if the map doesn't fit
+    size_t size = memmap->header.size;
+    if (size > sizeof(mb_memmap_copy))
+        size = sizeof(mb_memmap_info_t) +
+            (sizeof(mb_memmap_copy) - sizeof(mb_memmap_info_t)) / memmap->entry_size * memmap->entry_size;
+
+    memcpy(mb_memmap_copy, memmap, size);
+    mb_memmap_info_t *copy = (mb_memmap_info_t*)mb_memmap_copy;
+    copy->header.size = size;
+    return copy;
 }
@@ -74,7 +74,9 @@ extern mb_rsdp_t        *mb_acpi_rsdp_v1;
 extern mb_rsdp_t        *mb_acpi_rsdp_v2;
 
 /**
- * Parses Multiboot boot information and fills global pointers
+ * Parses Multiboot boot information and fills global pointers. 
+ * Used tags are copied into kernel memory, so the boot info itself
+ * is not needed afterwards and may be reused by the frame allocator
  * 
  * \param early_data Pointer to early boot info passed to the higher half kernel main
  */
@@ -97,9 +99,4 @@ void mb_memmap_iter_init(mb_memmap_iter_t *it);
  */
 mb_memmap_entry_t *mb_memmap_iter_next(mb_memmap_iter_t *it);
 
-/**
- * \return Memory region occupied by Multiboot boot info
- */
-mem_region_t mb_memory_region();
-
 #endif
@@ -2,7 +2,7 @@
 #include "kernel/console.h"
 #include "kernel/printk.h"
 
-void __panic(const char* location, const char* fmt, ...)
+__cold void __panic(const char* location, const char* fmt, ...)
 {
     if (cons_initialized)
     {
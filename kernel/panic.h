@@ -6,7 +6,7 @@
 #define __S1(x) #x
 #define __S2(x) __S1(x)
 
-void __panic(const char* location, const char* fmt, ...);
+__cold void __panic(const char* location, const char* fmt, ...);
 
 #define panic(msg, ...) __panic(__FILE__ ":" __S2(__LINE__), msg __VA_OPT__(,) __VA_ARGS__)
 #define panic_on_reach() panic("reached unreachable")
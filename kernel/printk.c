@@ -2,7 +2,8 @@
 #include "kernel/printk.h"
 #include "kernel/console.h"
 
-enum { PRINTK_BUF_SIZE = 11 };
+// Fits "0x" prefixed 64-bit pointer
+enum { PRINTK_BUF_SIZE = 18 };
 static const char digits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
 
 const char* errcode_str[] =
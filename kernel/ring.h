@@ -0,0 +1,45 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+// Entries in each queue, must be a power of two
+#define RING_ENTRIES 64
+
+/**
+ * Operation to perform. 
+ * Opcodes are syscall numbers, arguments are passed the same way as to the syscall
+ */
+typedef struct ring_sqe
+{
+    uint64_t opcode;
+    uint64_t args[3];
+    // Copied to the completion entry as is
+    uint64_t user_data;
+} ring_sqe_t;
+
+typedef struct ring_cqe
+{
+    // Syscall return value
+    int64_t result;
+    uint64_t user_data;
+} ring_cqe_t;
+
+/**
+ * Submission and completion queues placed in task's memory and passed to SYS_RING_ENTER. 
+ * Heads and tails are free running, entry index is counter % RING_ENTRIES. 
+ * Task fills submission entries and advances sq_tail, kernel advances sq_head once an entry is consumed. 
+ * Kernel fills completion entries and advances cq_tail, task advances cq_head once it has read them
+ */
+typedef struct ring
+{
+    uint32_t sq_head;
+    uint32_t sq_tail;
+    uint32_t cq_head;
+    uint32_t cq_tail;
+
+    ring_sqe_t sqes[RING_ENTRIES];
+    ring_cqe_t cqes[RING_ENTRIES];
+} ring_t;
+
+#endif
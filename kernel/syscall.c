@@ -1,52 +1,101 @@
 #include <kernel/syscall.h>
 #include <kernel/panic.h>
 #include <kernel/printk.h>
+#include <kernel/kbench.h>
+#include <kernel/time.h>
+#include <kernel/ring.h>
 #include <arch/x86/arch.h>
 #include <sched/sched.h>
+#include <mm/frame_alloc.h>
+#include <mm/obj.h>
+#include <mm/kmalloc.h>
 #include <common.h>
 
 static int64_t sys_sleep (arch_regs_t* regs);
 static int64_t sys_fork  (arch_regs_t* regs);
-static int64_t sys_getpid(arch_regs_t* regs);
 static int64_t sys_exit  (arch_regs_t* regs);
 static int64_t sys_wait  (arch_regs_t* regs);
+static int64_t sys_meminfo(arch_regs_t* regs);
+static int64_t sys_nanosleep(arch_regs_t* regs);
+static int64_t sys_ring_enter(arch_regs_t* regs);
+#ifdef KBENCH
+static int64_t sys_kbench_getpid(arch_regs_t* regs);
+#endif
 
-static syscall_fn_t syscall_table[] =
+static int64_t sys_getpid(uint64_t arg0, uint64_t arg1, uint64_t arg2);
+#ifdef KBENCH
+static int64_t sys_kbench(uint64_t op, uint64_t id, uint64_t cycles);
+#endif
+static int64_t sys_clock_gettime(uint64_t arg0, uint64_t arg1, uint64_t arg2);
+
+static syscall_fn_t syscall_table[SYS_MAX] =
 {
     [SYS_SLEEP] = sys_sleep,
     [SYS_FORK] = sys_fork,
-    [SYS_GETPID] = sys_getpid,
     [SYS_EXIT] = sys_exit,
-    [SYS_WAIT] = sys_wait
+    [SYS_WAIT] = sys_wait,
+    [SYS_MEMINFO] = sys_meminfo,
+    [SYS_NANOSLEEP] = sys_nanosleep,
+    [SYS_RING_ENTER] = sys_ring_enter,
+#ifdef KBENCH
+    [SYS_KBENCH_GETPID] = sys_kbench_getpid
+#endif
 };
 
-uint64_t do_syscall(uint64_t sysno, arch_regs_t* regs)
+// Looked up by syscall_entry before the full path, so each syscall has an entry in one of the tables only
+syscall_fast_fn_t syscall_fast_table[SYS_MAX] =
+{
+    [SYS_GETPID] = sys_getpid,
+#ifdef KBENCH
+    [SYS_KBENCH] = sys_kbench,
+#endif
+    [SYS_CLOCK_GETTIME] = sys_clock_gettime
+};
+
+const uint64_t syscall_fast_count = SYS_MAX;
+
+__hot uint64_t do_syscall(uint64_t sysno, arch_regs_t* regs)
 {
     if (sysno >= SYS_MAX)
         return -ENOSYS;
 
     syscall_fn_t syscall = syscall_table[sysno];
+    if (syscall == NULL)
+        return -ENOSYS;
+
     return syscall(regs);
 }
 
 static int64_t sys_sleep(arch_regs_t* regs)
 {
-    // Prepare to sleep
     uint64_t ms = syscall_arg0(regs);
-    sched_current()->sleep_until = sched_timer + ms / SCHED_TIMER_PERIOD;
-    sched_current()->state = TASK_SLEEPING;
+    uint64_t ns = ms > UINT64_MAX / NSEC_PER_MSEC ? UINT64_MAX : ms * NSEC_PER_MSEC;
+    sched_sleep_until(time_deadline(ns));
+    return 0;
+}
 
-    // Go back to scheduler
-    sched_switch();
-    // Returned to this task at the moment
+static int64_t sys_nanosleep(arch_regs_t* regs)
+{
+    uint64_t ns = syscall_arg0(regs);
+    sched_sleep_until(time_deadline(ns));
     return 0;
 }
 
-static int64_t sys_getpid(arch_regs_t* regs)
+static int64_t sys_getpid(uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    UNUSED(arg0);
+    UNUSED(arg1);
+    UNUSED(arg2);
+    return sched_current()->pid;
+}
+
+#ifdef KBENCH
+static int64_t sys_kbench_getpid(arch_regs_t* regs)
 {
     UNUSED(regs);
-    return _current->pid;
+    return sys_getpid(0, 0, 0);
 }
+#endif
 
 static int64_t sys_fork(arch_regs_t* parent_regs)
 {
@@ -58,6 +107,10 @@ static int64_t sys_fork(arch_regs_t* parent_regs)
     if (res < 0)
         return res;
 
+    res = sched_setup_vdata(child);
+    if (res < 0)
+        return res;
+
     arch_regs_t* child_regs = NULL;
     res = arch_thread_clone_current(&child->arch_thread, &child_regs);
     if (res < 0)
@@ -125,3 +178,139 @@ static int64_t sys_wait(arch_regs_t* regs)
     printk("sys_wait: pid %d reaped child with pid %d\n", sched_current()->pid, child_pid);
     return 0;
 }
+
+static int64_t sys_meminfo(arch_regs_t* regs)
+{
+    meminfo_t* buf = (meminfo_t*)syscall_arg0(regs);
+    size_t size = syscall_arg1(regs);
+
+    // Caller must be able to receive at least the version
+    if (size < offsetof(meminfo_t, total_pages))
+        return -EINVAL;
+
+    vmem_area_t *area = vmem_is_mapped(&sched_current()->vmem, buf);
+    if (area == NULL || (area->flags & (VMEM_USER | VMEM_WRITE)) != (VMEM_USER | VMEM_WRITE) ||
+        size > area->start + area->size * PAGE_SIZE - (uint64_t)buf)
+    {
+        // Invalid address or task doesn't have permission to write to it
+        return -EINVAL;
+    }
+
+    meminfo_t* info = kmalloc(sizeof(meminfo_t));
+    if (info == NULL)
+        return -ENOMEM;
+
+    memset(info, 0, sizeof(meminfo_t));
+    info->version = MEMINFO_VERSION;
+    info->size    = sizeof(meminfo_t);
+
+    frame_alloc_meminfo(info);
+    object_meminfo(info);
+    vmem_meminfo(info);
+
+    // Older callers get the prefix they know about
+    if (size > sizeof(meminfo_t))
+        size = sizeof(meminfo_t);
+
+    memcpy(buf, info, size);
+    kfree(info);
+    return size;
+}
+
+#ifdef KBENCH
+static int64_t sys_kbench(uint64_t op, uint64_t id, uint64_t cycles)
+{
+    switch (op)
+    {
+    case KBENCH_OP_RECORD:
+        if (id >= KBENCH_COUNT)
+            return -EINVAL;
+
+        kbench_record(id, cycles);
+        return 0;
+
+    case KBENCH_OP_FINISH:
+        kbench_finish();
+        __builtin_unreachable();
+
+    default:
+        return -EINVAL;
+    }
+}
+#endif
+
+static int64_t sys_clock_gettime(uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    UNUSED(arg0);
+    UNUSED(arg1);
+    UNUSED(arg2);
+    return time_ns();
+}
+
+static int64_t ring_execute(const ring_sqe_t* sqe)
+{
+    switch (sqe->opcode)
+    {
+    case SYS_FORK:
+    case SYS_EXIT:
+    case SYS_RING_ENTER:
+        // Need the task's own registers or don't return
+        return -EINVAL;
+    }
+
+    if (sqe->opcode >= SYS_MAX)
+        return -ENOSYS;
+
+    syscall_fast_fn_t fast_syscall = syscall_fast_table[sqe->opcode];
+    if (fast_syscall != NULL)
+        return fast_syscall(sqe->args[0], sqe->args[1], sqe->args[2]);
+
+    syscall_fn_t syscall = syscall_table[sqe->opcode];
+    if (syscall == NULL)
+        return -ENOSYS;
+
+    arch_regs_t regs = {};
+    syscall_arg0(&regs) = sqe->args[0];
+    syscall_arg1(&regs) = sqe->args[1];
+    syscall_arg2(&regs) = sqe->args[2];
+    return syscall(&regs);
+}
+
+static int64_t sys_ring_enter(arch_regs_t* regs)
+{
+    ring_t* ring = (ring_t*)syscall_arg0(regs);
+    uint32_t to_submit = syscall_arg1(regs);
+
+    vmem_area_t *area = vmem_is_mapped(&sched_current()->vmem, ring);
+    if (area == NULL || (area->flags & (VMEM_USER | VMEM_WRITE)) != (VMEM_USER | VMEM_WRITE) ||
+        sizeof(ring_t) > area->start + area->size * PAGE_SIZE - (uint64_t)ring || ((uint64_t)ring & 7) != 0)
+    {
+        // Invalid address or task doesn't have permission to write to it
+        return -EINVAL;
+    }
+
+    // Operations are executed in order, one that blocks delays the rest of the batch
+    uint32_t submitted = 0;
+    for (; submitted < to_submit; submitted++)
+    {
+        uint32_t sq_head = ring->sq_head;
+        if (sq_head == __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE))
+            break;
+
+        // Completion is never dropped, the rest waits for the task to free completion queue
+        uint32_t cq_tail = ring->cq_tail;
+        if (cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= RING_ENTRIES)
+            break;
+
+        // Task may rewrite the entry meanwhile
+        ring_sqe_t sqe = ring->sqes[sq_head % RING_ENTRIES];
+        __atomic_store_n(&ring->sq_head, sq_head + 1, __ATOMIC_RELEASE);
+
+        ring_cqe_t* cqe = &ring->cqes[cq_tail % RING_ENTRIES];
+        cqe->result = ring_execute(&sqe);
+        cqe->user_data = sqe.user_data;
+        __atomic_store_n(&ring->cq_tail, cq_tail + 1, __ATOMIC_RELEASE);
+    }
+
+    return submitted;
+}
@@ -12,9 +12,23 @@ enum
     SYS_GETPID = 2,
     SYS_EXIT = 3,
     SYS_WAIT = 4,
+    SYS_MEMINFO = 5,
+    SYS_KBENCH = 6,
+    SYS_CLOCK_GETTIME = 7,
+    SYS_NANOSLEEP = 8,
+    SYS_RING_ENTER = 9,
+    // getpid through the full path, compared with the fast one by kbench
+    SYS_KBENCH_GETPID = 10,
     SYS_MAX
 };
 
 typedef int64_t (*syscall_fn_t)(arch_regs_t*);
 
+/**
+ * Fast syscalls are called straight from syscall_entry without building arch_regs_t. 
+ * They run with interrupts disabled on the task's kernel stack, so they must be short, 
+ * must not sleep or switch tasks and can't access user registers other than the arguments
+ */
+typedef int64_t (*syscall_fast_fn_t)(uint64_t arg0, uint64_t arg1, uint64_t arg2);
+
 #endif
@@ -0,0 +1,112 @@
+#include "kernel/time.h"
+#include "kernel/panic.h"
+#include "arch/x86/x86.h"
+#include "drivers/apic.h"
+#include "kernel/irq.h"
+#include "sched/sched.h"
+
+#define TICK_PERIOD (SCHED_TIMER_PERIOD * NSEC_PER_MSEC)
+
+uint64_t time_tsc_freq = 0;
+uint64_t time_tsc_base = 0;
+uint64_t time_tsc_mult = 0;
+
+// Timer runs in one-shot mode and is armed for the earliest of these
+static uint64_t next_tick   = 0;
+static uint64_t next_wakeup = UINT64_MAX;
+
+static uint64_t cpuid_tsc_freq();
+static void time_arm();
+
+void time_init()
+{
+    time_tsc_freq = cpuid_tsc_freq();
+    if (time_tsc_freq == 0)
+        time_tsc_freq = apic_tsc_freq();
+
+    kassert(time_tsc_freq != 0);
+
+    time_tsc_mult = (NSEC_PER_SEC << TIME_TSC_SHIFT) / time_tsc_freq;
+    time_tsc_base = x86_rdtsc();
+
+    bool invariant = x86_cpuid(0x80000000, 0).eax >= 0x80000007 && (x86_cpuid(0x80000007, 0).edx & (1 << 8));
+    printk("time: TSC %u kHz%s\n", (uint32_t)(time_tsc_freq / 1000), invariant ? "" : ", not invariant");
+
+    next_tick = TICK_PERIOD;
+    time_arm();
+}
+
+uint64_t time_ns()
+{
+    return ((unsigned __int128)(x86_rdtsc() - time_tsc_base) * time_tsc_mult) >> TIME_TSC_SHIFT;
+}
+
+uint64_t time_deadline(uint64_t ns)
+{
+    uint64_t now = time_ns();
+    return ns > UINT64_MAX - now ? UINT64_MAX : now + ns;
+}
+
+void time_wakeup_at(uint64_t deadline)
+{
+    // Timer interrupt rearms the timer too
+    bool enabled = irq_save();
+
+    if (deadline < next_wakeup)
+    {
+        next_wakeup = deadline;
+        time_arm();
+    }
+
+    irq_restore(enabled);
+}
+
+void time_handle_timer()
+{
+    uint64_t now = time_ns();
+
+    bool tick = now >= next_tick;
+    if (tick)
+    {
+        next_tick += TICK_PERIOD;
+        // Ticks missed while interrupts were disabled are dropped
+        if (next_tick <= now)
+            next_tick = now + TICK_PERIOD;
+    }
+
+    bool wakeup = now >= next_wakeup;
+    if (wakeup)
+    {
+        // Scheduler requests the next one while looking for tasks to wake up
+        next_wakeup = UINT64_MAX;
+    }
+
+    // Rearm before scheduler code runs, it may switch tasks
+    time_arm();
+
+    if (tick)
+        sched_timer_tick();
+
+    if (wakeup)
+        sched_wakeup();
+}
+
+static void time_arm()
+{
+    uint64_t deadline = next_tick < next_wakeup ? next_tick : next_wakeup;
+    uint64_t now = time_ns();
+    apic_timer_oneshot(deadline > now ? deadline - now : 0);
+}
+
+static uint64_t cpuid_tsc_freq()
+{
+    if (x86_cpuid(0, 0).eax < 0x15)
+        return 0;
+
+    // TSC frequency is crystal clock frequency multiplied by TSC/crystal ratio
+    x86_cpuid_regs_t regs = x86_cpuid(0x15, 0);
+    if (regs.eax == 0 || regs.ebx == 0 || regs.ecx == 0)
+        return 0;
+
+    return (uint64_t)regs.ecx * regs.ebx / regs.eax;
+}
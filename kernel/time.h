@@ -0,0 +1,47 @@
+#ifndef TIME_H
+#define TIME_H
+
+#include "common.h"
+
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC  1000000000ull
+
+// TSC ticks are converted to nanoseconds as (ticks * time_tsc_mult) >> TIME_TSC_SHIFT
+#define TIME_TSC_SHIFT 32
+
+extern uint64_t time_tsc_freq;
+extern uint64_t time_tsc_base;
+extern uint64_t time_tsc_mult;
+
+/**
+ * Calibrates TSC and starts the scheduler timer. 
+ * Requires APIC timer to be calibrated
+ */
+void time_init();
+
+/**
+ * \return Nanoseconds since time_init
+ */
+uint64_t time_ns();
+
+/**
+ * \param ns Delay in nanoseconds
+ * 
+ * \return Time after the given delay from now, UINT64_MAX if it doesn't fit
+ */
+uint64_t time_deadline(uint64_t ns);
+
+/**
+ * Requests timer interrupt at the given time if it's earlier than already planned one. 
+ * Scheduler timer ticks happen regardless
+ * 
+ * \param deadline Time in nanoseconds since time_init
+ */
+void time_wakeup_at(uint64_t deadline);
+
+/**
+ * Timer interrupt handler
+ */
+void time_handle_timer();
+
+#endif
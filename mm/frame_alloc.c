@@ -1,33 +1,83 @@
 #include "common.h"
 #include "kernel/multiboot.h"
 #include "kernel/panic.h"
+#include "arch/x86/simd.h"
+#include "drivers/numa.h"
 #include "mm/paging.h"
 #include "mm/frame_alloc.h"
+#include "mm/obj.h"
+#include "mm/vmem.h"
 #include "utils/list.h"
 
-#define MAX_ORDER 10
-#define MAX_ZONE_COUNT 10
+// Max order blocks are 1GB, so huge pages of any size can be backed by the allocator
+#define MAX_ORDER 18
+// Memory regions are additionally split at NUMA node boundaries
+#define MAX_ZONE_COUNT 16
+#define MAX_RESERVED_COUNT (MAX_ZONE_COUNT + 2)
+
+// Physical memory below this address is never used (BIOS data, EBDA, Multiboot header)
+#define LOW_MEMORY_END MB
+
+// Frames are grouped by mobility in units of blocks of this order (2MB)
+#define PAGEBLOCK_ORDER 9
+
+#define MIGRATE_UNMOVABLE 0
+#define MIGRATE_MOVABLE   1
+#define MIGRATE_TYPES     2
 
 typedef struct free_blocks_list
 {
-    list_node_t free_blocks_head;
+    // Free blocks are kept in separate lists according to the type of their pageblock
+    list_node_t free_blocks_head[MIGRATE_TYPES];
     uint8_t *bitmap;
+    size_t count;
 } free_blocks_list_t;
 
 typedef struct allocator_zone
 {
     free_blocks_list_t orders[MAX_ORDER + 1]; 
+    // Start of the zone rounded down to the max order block size - base for block indices
+    void* base_addr;
     void* start_addr;
     void* end_addr;
     size_t pages_count;
+    size_t free_pages;
+    // Descriptors of all the zone frames, indexed by frame number relative to start_addr
+    frame_t* frames;
+    // Migrate type of each pageblock, indexed relative to base_addr
+    uint8_t* pageblock_types;
+    // NUMA node which owns the zone memory
+    int node;
 } allocator_zone_t;
 
 static allocator_zone_t allocator_zones[MAX_ZONE_COUNT] = {0};
 static size_t zones_count = 0;
 
-static size_t zone_add(uint64_t addr, size_t pages_count);
-static void *zone_alloc(allocator_zone_t *zone, int order);
+// Allocated frames by owner type
+static size_t type_pages[FRAME_TYPES_COUNT] = {0};
+
+// For each node, indices of all the zones ordered by distance from that node
+static uint8_t zonelists[MAX_NUMA_NODES][MAX_ZONE_COUNT] = {0};
+
+// Sorted list of regions which must not be handed out (direct mapping addresses)
+static mem_region_t reserved_regions[MAX_RESERVED_COUNT] = {0};
+static size_t reserved_count = 0;
+
+static size_t zone_add(uint64_t addr, size_t pages_count, int node);
+static void build_zonelists();
+static allocator_zone_t *zone_by_addr(uint64_t addr);
+static void frames_release(allocator_zone_t *zone, frame_t *desc, uint64_t addr);
+static size_t zone_free_range(allocator_zone_t *zone, uint64_t start, uint64_t end);
+static void zone_mark_reserved(allocator_zone_t *zone, uint64_t start, uint64_t end);
+static void *zone_alloc(allocator_zone_t *zone, int order, int migratetype);
+static void *zone_steal(allocator_zone_t *zone, int order, int migratetype);
+static void *zone_take_block(allocator_zone_t *zone, list_node_t *block, int block_order, int order);
 static void zone_dealloc(allocator_zone_t *zone, uint64_t addr, int order);
+static int block_migratetype(allocator_zone_t *zone, uint64_t addr);
+static bool frames_compact(int order);
+static int block_migration_cost(allocator_zone_t *zone, uint64_t start, uint64_t end);
+static void reserve_region(uint64_t start, uint64_t end);
+static uint64_t find_unreserved_space(uint64_t start, uint64_t end, size_t size);
 static int pages2order(size_t pages);
 
 // Those constants are defined by linker script.
@@ -41,13 +91,11 @@ void frame_alloc_init()
     mb_memmap_entry_t *mmap_entry;
     size_t pgcnt = 0;
 
-    // Avoid preserved regions
-    uint64_t reserved_end  = (uint64_t)PHYS_TO_VIRT(&_phys_end_kernel_sections);
-    uint64_t reserved_end2 = (uint64_t)mb_memory_region().end;
-    if (reserved_end2 > reserved_end)
-        reserved_end = reserved_end2;
-
-    reserved_end = ROUNDUP(reserved_end, PAGE_SIZE);
+    // Multiboot info has already been copied by mb_parse_boot_info, so only the kernel
+    // and low memory have to be preserved
+    reserve_region((uint64_t)PHYS_TO_VIRT(0), (uint64_t)PHYS_TO_VIRT(LOW_MEMORY_END));
+    reserve_region((uint64_t)PHYS_TO_VIRT(&_phys_start_kernel_sections),
+                   (uint64_t)PHYS_TO_VIRT(&_phys_end_kernel_sections));
 
     while ((mmap_entry = mb_memmap_iter_next(&mmap_it)) != NULL)
     {
@@ -55,62 +103,111 @@ void frame_alloc_init()
             continue;
 
         uint64_t base_addr = (uint64_t)PHYS_TO_VIRT(mmap_entry->base_addr);
+        uint64_t end_addr  = ROUNDDOWN(base_addr + mmap_entry->length, PAGE_SIZE);
         base_addr = ROUNDUP(base_addr, PAGE_SIZE);
-        size_t region_size = mmap_entry->length / PAGE_SIZE;
-
-        if (base_addr < reserved_end)
-        {
-            // I don't want to bother with preserving
-            // a memory region occupied by the kernel an Multiboot info.
-            // So just ignore - we've already wasted a lot of memory)0
-
-            if (reserved_end >= base_addr + region_size * PAGE_SIZE)
-                continue;
-
-            region_size -= (reserved_end - base_addr) / PAGE_SIZE;
-            base_addr = reserved_end;
-        }
+        if (base_addr >= end_addr)
+            continue;
 
-        if (region_size < ((size_t)1 << MAX_ORDER))
+        // Each zone must belong to a single node
+        while (base_addr < end_addr)
         {
-            // Ignore too small zone
-            continue;
+            uint64_t node_end = (uint64_t)VIRT_TO_PHYS(end_addr);
+            int node = numa_node_of_range((uint64_t)VIRT_TO_PHYS(base_addr), &node_end);
+            uint64_t zone_end = ROUNDDOWN((uint64_t)PHYS_TO_VIRT(node_end), PAGE_SIZE);
+            if (zone_end <= base_addr)
+                zone_end = ROUNDUP((uint64_t)PHYS_TO_VIRT(node_end), PAGE_SIZE);
+
+            if (zones_count == MAX_ZONE_COUNT)
+            {
+                printk("frame_alloc: too many memory regions, ignoring region at %p\n", base_addr);
+                break;
+            }
+
+            // printk("zone_add: region at %p with %d pages on node %d\n", base_addr, (zone_end - base_addr) / PAGE_SIZE, node);
+            pgcnt += zone_add(base_addr, (zone_end - base_addr) / PAGE_SIZE, node);
+            base_addr = zone_end;
         }
-
-        // printk("zone_add: region at %p with %d pages\n", base_addr, region_size);
-        pgcnt += zone_add(base_addr, region_size);
     }
 
+    build_zonelists();
+
     printk("Frame allocator initialized with %d frames\n", pgcnt);
 }
 
 void* frames_alloc(size_t n) 
 {
-    int order = pages2order(n);
-    for (int i = 0; i < (int)zones_count; i++)
-    {
-        void* block = zone_alloc(&allocator_zones[i], order);
-        if (block != NULL)
-            return block;
-    }
-
-    return NULL;
+    return frames_alloc_type(n, FRAME_TYPE_KERNEL);
 }
 
-void frames_free(void* addr, size_t n)
+void* frames_alloc_type(size_t n, frame_type_t type)
 {
+    kassert_dbg(n > 0);
+    kassert_dbg(type != FRAME_TYPE_FREE);
+
+    // Only user pages can be migrated by rewriting their mappings
+    int migratetype = type == FRAME_TYPE_USER ? MIGRATE_MOVABLE : MIGRATE_UNMOVABLE;
     int order = pages2order(n);
-    for (int i = 0; i < (int)zones_count; i++)
+
+    allocator_zone_t *zone = NULL;
+    void* block = NULL;
+    uint8_t *zonelist = zonelists[numa_current_node()];
+
+    // Prefer blocks of the same mobility in any zone, then steal from the other type.
+    // Under memory pressure release spare slabs and finally compact. 
+    // Compaction is limited to pageblocks, callers of larger allocations fall back to smaller pages
+    for (int attempt = 0; attempt < 4 && block == NULL; attempt++)
     {
-        if ((uint64_t)allocator_zones[i].start_addr <= (uint64_t)addr &&
-            (uint64_t)addr < (uint64_t)allocator_zones[i].end_addr)
+        if (attempt == 2 && object_shrink() == 0)
+            continue;
+
+        if (attempt == 3 && (order == 0 || order > PAGEBLOCK_ORDER || !frames_compact(order)))
+            break;
+
+        for (int i = 0; i < (int)zones_count && block == NULL; i++)
         {
-            zone_dealloc(&allocator_zones[i], (uint64_t)addr, order);
-            return;
+            zone = &allocator_zones[zonelist[i]];
+            if (attempt != 1)
+                block = zone_alloc(zone, order, migratetype);
+
+            if (block == NULL && attempt != 0)
+                block = zone_steal(zone, order, migratetype);
         }
     }
 
-    panic("frames_free on unknown address %p", addr);
+    if (block != NULL)
+    {
+        // Give the unused tail of the block back to the lower orders
+        if (n < ((size_t)1 << order))
+            zone_free_range(zone, (uint64_t)block + n * PAGE_SIZE,
+                            (uint64_t)block + ((size_t)1 << order) * PAGE_SIZE);
+
+        // Only pages handed to the caller, the tail is cleared by whoever allocates it next
+        clear_pages(block, n);
+
+        frame_t *desc = &zone->frames[((uint64_t)block - (uint64_t)zone->start_addr) / PAGE_SIZE];
+        desc->refcount = 1;
+        desc->pages    = n;
+        desc->flags    = 0;
+        desc->type     = type;
+        desc->mapping  = NULL;
+        type_pages[type] += n;
+    }
+
+    return block;
+}
+
+void frames_free(void* addr)
+{
+    allocator_zone_t *zone = zone_by_addr((uint64_t)addr);
+    if (zone == NULL)
+        panic("frames_free on unknown address %p", addr);
+
+    frame_t *desc = &zone->frames[((uint64_t)addr - (uint64_t)zone->start_addr) / PAGE_SIZE];
+    if (desc->pages == 0)
+        panic("frames_free on address %p which is not allocated", addr);
+
+    kassert_dbg(desc->refcount <= 1);
+    frames_release(zone, desc, (uint64_t)addr);
 }
 
 void* frame_alloc()
@@ -120,126 +217,343 @@ void* frame_alloc()
 
 void frame_free(void* addr)
 {
-    return frames_free(addr, 1);
+    return frames_free(addr);
+}
+
+frame_t* frame_desc(void* addr)
+{
+    allocator_zone_t *zone = zone_by_addr((uint64_t)addr);
+    if (zone == NULL)
+        return NULL;
+
+    return &zone->frames[((uint64_t)addr - (uint64_t)zone->start_addr) / PAGE_SIZE];
+}
+
+void frame_get(void* addr)
+{
+    frame_t *desc = frame_desc(addr);
+    kassert(desc != NULL && desc->pages != 0);
+
+    desc->refcount++;
+}
+
+void frame_put(void* addr)
+{
+    frame_t *desc = frame_desc(addr);
+    kassert(desc != NULL && desc->pages != 0 && desc->refcount > 0);
+
+    desc->refcount--;
+    if (desc->refcount == 0)
+        frames_release(zone_by_addr((uint64_t)addr), desc, (uint64_t)addr);
+}
+
+void frame_alloc_meminfo(meminfo_t *info)
+{
+    kassert_dbg(info != NULL);
+
+    for (size_t i = 0; i < FRAME_TYPES_COUNT && i < MEMINFO_MAX_TYPES; i++)
+        info->type_pages[i] = type_pages[i];
+
+    info->zones_count = 0;
+    for (size_t i = 0; i < zones_count && i < MEMINFO_MAX_ZONES; i++)
+    {
+        allocator_zone_t *zone = &allocator_zones[i];
+        meminfo_zone_t *zone_info = &info->zones[info->zones_count++];
+
+        zone_info->start       = (uint64_t)VIRT_TO_PHYS(zone->start_addr);
+        zone_info->end         = (uint64_t)VIRT_TO_PHYS(zone->end_addr);
+        zone_info->node        = zone->node;
+        zone_info->total_pages = zone->pages_count;
+        zone_info->free_pages  = zone->free_pages;
+        for (int order = 0; order <= MAX_ORDER && order < MEMINFO_MAX_ORDERS; order++)
+            zone_info->free_blocks[order] = zone->orders[order].count;
+
+        info->total_pages += zone->pages_count;
+        info->free_pages  += zone->free_pages;
+    }
+}
+
+void frame_alloc_walk_free(frame_walk_fn_t fn, void* ctx)
+{
+    for (size_t i = 0; i < zones_count; i++)
+    {
+        allocator_zone_t *zone = &allocator_zones[i];
+        for (int order = 0; order <= MAX_ORDER; order++)
+        {
+            for (int migratetype = 0; migratetype < MIGRATE_TYPES; migratetype++)
+            {
+                list_node_t *head = &zone->orders[order].free_blocks_head[migratetype];
+                for (list_node_t *block = head->next; block != head; block = block->next)
+                {
+                    int pair_bit = -1;
+                    if (order < MAX_ORDER)
+                    {
+                        size_t block_index = ((uint64_t)block - (uint64_t)zone->base_addr) / (((size_t)1 << order) * PAGE_SIZE);
+                        size_t buddy_index = block_index / 2;
+                        pair_bit = GET_BIT(zone->orders[order].bitmap[buddy_index / 8], buddy_index % 8) ? 1 : 0;
+                    }
+
+                    fn(block, order, pair_bit, ctx);
+                }
+            }
+        }
+    }
 }
 
-static size_t zone_add(uint64_t addr, size_t pages_count)
+static size_t zone_add(uint64_t addr, size_t pages_count, int node)
 {
     kassert_dbg((addr & (~(PAGE_SIZE - 1))) == addr);
-    kassert_dbg(pages_count > ((size_t)1 << MAX_ORDER));
     kassert_dbg(zones_count < MAX_ZONE_COUNT);
 
-    allocator_zone_t *zone = &allocator_zones[zones_count++];
-    zone->start_addr = (void*)addr;
+    uint64_t end_addr  = addr + pages_count * PAGE_SIZE;
+    uint64_t base_addr = ROUNDDOWN(addr, PAGE_SIZE * ((size_t)1 << MAX_ORDER));
 
-    // 1. Determine max possible bitmap size and reserve space for it
+    // 1. Determine bitmap size. Bitmaps cover the zone extended to the max order block boundaries,
+    // so unaligned head and tail of the zone can be managed by lower orders
+
+    size_t window_pages = (ROUNDUP(end_addr, PAGE_SIZE * ((size_t)1 << MAX_ORDER)) - base_addr) / PAGE_SIZE;
 
     // In bytes
     size_t required_bitmap_size = 0;
-    for (int i = 0; i <= MAX_ORDER; i++)
-        required_bitmap_size += DIV_ROUNDUP(pages_count / ((size_t)1 << i) / 2, 8);
+    for (int i = 0; i < MAX_ORDER; i++)
+        required_bitmap_size += DIV_ROUNDUP(window_pages >> (i + 1), 8);
+
+    // Frame descriptors and pageblock types follow the bitmaps
+    size_t frames_offset     = ROUNDUP(required_bitmap_size, sizeof(uint64_t));
+    size_t pageblocks_offset = frames_offset + pages_count * sizeof(frame_t);
+    size_t metadata_size     = pageblocks_offset + (window_pages >> PAGEBLOCK_ORDER);
+
+    // 2. Place metadata into the first unreserved part of the zone which is large enough
+
+    uint64_t bitmap_ptr = find_unreserved_space(addr, end_addr, ROUNDUP(metadata_size, PAGE_SIZE));
+    if (bitmap_ptr == 0)
+    {
+        // Region is either occupied by the kernel or too small
+        return 0;
+    }
 
-    // In pages
-    size_t bitmap_size = DIV_ROUNDUP(required_bitmap_size, PAGE_SIZE);
-    uint64_t bitmap_ptr = (uint64_t)zone->start_addr;
-    zone->start_addr += PAGE_SIZE * bitmap_size;
-    pages_count -= bitmap_size;
+    reserve_region(bitmap_ptr, bitmap_ptr + ROUNDUP(metadata_size, PAGE_SIZE));
+    memset((void*)bitmap_ptr, 0, metadata_size);
 
-    // 2. Align remaining part of the zone by the max allocation size
-    // (Wasting up to 2 * (1 << MAX_ORDER) pages of out precious memory!)
-    zone->start_addr = ROUNDUP  (zone->start_addr,  PAGE_SIZE * ((size_t)1 << MAX_ORDER));
-    zone->end_addr   = ROUNDDOWN(zone->start_addr + pages_count * PAGE_SIZE, PAGE_SIZE * ((size_t)1 << MAX_ORDER));
+    allocator_zone_t *zone = &allocator_zones[zones_count++];
+    zone->base_addr   = (void*)base_addr;
+    zone->start_addr  = (void*)addr;
+    zone->end_addr    = (void*)end_addr;
+    zone->pages_count = pages_count;
+    zone->node        = node;
+    zone->frames      = (frame_t*)(bitmap_ptr + frames_offset);
 
-    // Final pages count value!  
-    zone->pages_count = ((uint64_t)zone->end_addr - (uint64_t)zone->start_addr) / PAGE_SIZE;
+    // All the memory is movable until unmovable allocations claim it
+    zone->pageblock_types = (uint8_t*)(bitmap_ptr + pageblocks_offset);
+    memset(zone->pageblock_types, MIGRATE_MOVABLE, window_pages >> PAGEBLOCK_ORDER);
 
-    // 2. Fill bitmaps pointers
+    // 3. Fill bitmaps pointers
 
     for (int i = 0; i < MAX_ORDER; i++)
     {
-        size_t order_bitmap_size = DIV_ROUNDUP(zone->pages_count / ((size_t)1 << MAX_ORDER) / 2, 8);
         zone->orders[i].bitmap = (uint8_t*)bitmap_ptr;
-        bitmap_ptr += order_bitmap_size;
-        kassert(bitmap_ptr < bitmap_ptr + bitmap_size * PAGE_SIZE);
-
-        list_init(&zone->orders[i].free_blocks_head);
+        bitmap_ptr += DIV_ROUNDUP(window_pages >> (i + 1), 8);
     }
 
     zone->orders[MAX_ORDER].bitmap = NULL;
-    list_init(&zone->orders[MAX_ORDER].free_blocks_head);
 
-    for (size_t i = 0; i < zone->pages_count / ((size_t)1 << MAX_ORDER); i++)
+    for (int i = 0; i <= MAX_ORDER; i++)
+    {
+        for (int j = 0; j < MIGRATE_TYPES; j++)
+            list_init(&zone->orders[i].free_blocks_head[j]);
+    }
+
+    // 4. All the frames are considered to be allocated now (zeroed bitmaps).
+    // Release everything except reserved regions, which are marked as pinned kernel allocations
+
+    size_t free_pages = 0;
+    uint64_t curr = addr;
+    for (size_t i = 0; i < reserved_count && curr < end_addr; i++)
     {
-        list_node_t *block_ptr = zone->start_addr + i * ((size_t)1 << MAX_ORDER) * PAGE_SIZE;
-        list_init(block_ptr);
-        list_insert_after(&zone->orders[MAX_ORDER].free_blocks_head, block_ptr);
+        uint64_t reserved_start = (uint64_t)reserved_regions[i].start;
+        uint64_t reserved_end   = (uint64_t)reserved_regions[i].end;
+        if (reserved_end <= curr)
+            continue;
+
+        if (reserved_start > curr)
+            free_pages += zone_free_range(zone, curr, reserved_start < end_addr ? reserved_start : end_addr);
+
+        if (reserved_start < end_addr)
+            zone_mark_reserved(zone, reserved_start > curr ? reserved_start : curr,
+                               reserved_end < end_addr ? reserved_end : end_addr);
+
+        curr = reserved_end;
     }
 
-    return zone->pages_count;
+    if (curr < end_addr)
+        free_pages += zone_free_range(zone, curr, end_addr);
+
+    return free_pages;
 }
 
-static void *zone_alloc(allocator_zone_t *zone, int order)
+static void build_zonelists()
 {
-    kassert_dbg(zone != NULL);
-    kassert_dbg(order <= MAX_ORDER);
+    for (int node = 0; node < numa_nodes_count(); node++)
+    {
+        uint8_t *zonelist = zonelists[node];
+        for (size_t i = 0; i < zones_count; i++)
+            zonelist[i] = i;
+
+        // Insertion sort by distance, zones of equal distance stay in address order
+        for (size_t i = 1; i < zones_count; i++)
+        {
+            uint8_t curr = zonelist[i];
+            int curr_distance = numa_distance(node, allocator_zones[curr].node);
+
+            size_t j = i;
+            for (; j > 0 && numa_distance(node, allocator_zones[zonelist[j - 1]].node) > curr_distance; j--)
+                zonelist[j] = zonelist[j - 1];
+
+            zonelist[j] = curr;
+        }
+    }
+}
 
-    list_node_t *order_blocks_head = &zone->orders[order].free_blocks_head;
-    if (!list_empty(order_blocks_head))
+static allocator_zone_t *zone_by_addr(uint64_t addr)
+{
+    for (size_t i = 0; i < zones_count; i++)
     {
-        // Perfect fit
-        list_node_t *block = order_blocks_head->next;
-        list_extract(block);
+        if ((uint64_t)allocator_zones[i].start_addr <= addr && addr < (uint64_t)allocator_zones[i].end_addr)
+            return &allocator_zones[i];
+    }
 
-        size_t block_index = ((uint64_t)block - (uint64_t)zone->start_addr) / (((size_t)1 << order) * PAGE_SIZE);
-        size_t buddy_index = block_index / 2;
-        uint8_t *bitmap = zone->orders[order].bitmap;
-        bitmap[buddy_index / 8] = FLIP_BIT(bitmap[buddy_index / 8], buddy_index % 8);
-        
-        memset(block, 0, PAGE_SIZE * ((size_t)1 << order));
-        return (void*)block;
+    return NULL;
+}
+
+static void frames_release(allocator_zone_t *zone, frame_t *desc, uint64_t addr)
+{
+    size_t n = desc->pages;
+    type_pages[desc->type] -= n;
+
+    desc->refcount = 0;
+    desc->pages    = 0;
+    desc->flags    = 0;
+    desc->type     = FRAME_TYPE_FREE;
+    desc->mapping  = NULL;
+
+    // Region is released in the same blocks as its tail was split off on allocation,
+    // so buddies coalesce back into the original block
+    zone_free_range(zone, addr, addr + n * PAGE_SIZE);
+}
+
+static void zone_mark_reserved(allocator_zone_t *zone, uint64_t start, uint64_t end)
+{
+    // Every frame is marked separately, so no reserved frame looks free from the inside of the region
+    for (uint64_t addr = start; addr < end; addr += PAGE_SIZE)
+    {
+        frame_t *desc = &zone->frames[(addr - (uint64_t)zone->start_addr) / PAGE_SIZE];
+        desc->refcount = 1;
+        desc->pages    = 1;
+        desc->flags    = FRAME_PINNED;
+        desc->type     = FRAME_TYPE_KERNEL;
+        desc->mapping  = NULL;
     }
 
-    // Check for larger blocks
+    type_pages[FRAME_TYPE_KERNEL] += (end - start) / PAGE_SIZE;
+}
+
+static size_t zone_free_range(allocator_zone_t *zone, uint64_t start, uint64_t end)
+{
+    kassert_dbg(zone != NULL);
+    kassert_dbg((uint64_t)zone->start_addr <= start && end <= (uint64_t)zone->end_addr);
+
+    // Split range into the largest naturally aligned blocks
+    size_t pgcnt = 0;
+    while (start < end)
+    {
+        int order = MAX_ORDER;
+        while (order > 0 && ((start & (PAGE_SIZE * ((size_t)1 << order) - 1)) != 0 ||
+                             start + PAGE_SIZE * ((size_t)1 << order) > end))
+            order--;
+
+        zone_dealloc(zone, start, order);
+        start += PAGE_SIZE * ((size_t)1 << order);
+        pgcnt += (size_t)1 << order;
+    }
+
+    return pgcnt;
+}
+
+static void *zone_alloc(allocator_zone_t *zone, int order, int migratetype)
+{
+    kassert_dbg(zone != NULL);
+    kassert_dbg(order <= MAX_ORDER);
+
+    // Smallest block of the same mobility
     for (int i = order; i <= MAX_ORDER; i++)
     {
-        list_node_t *order_blocks_head = &zone->orders[i].free_blocks_head;
-        if (list_empty(order_blocks_head))
-            continue;
+        list_node_t *order_blocks_head = &zone->orders[i].free_blocks_head[migratetype];
+        if (!list_empty(order_blocks_head))
+            return zone_take_block(zone, order_blocks_head->next, i, order);
+    }
 
-        // Larger block is present, split it
+    return NULL;
+}
 
-        list_node_t *curr_split_block = order_blocks_head->next;
-        list_extract(curr_split_block);
+static void *zone_steal(allocator_zone_t *zone, int order, int migratetype)
+{
+    kassert_dbg(zone != NULL);
+    kassert_dbg(order <= MAX_ORDER);
 
-        if (i < MAX_ORDER)
+    // Largest block of other mobility, so types stay grouped in as few pageblocks as possible
+    for (int i = MAX_ORDER; i >= order; i--)
+    {
+        for (int j = 0; j < MIGRATE_TYPES; j++)
         {
-            size_t block_index = ((uint64_t)curr_split_block - (uint64_t)zone->start_addr) / (((size_t)1 << i) * PAGE_SIZE);
-            size_t buddy_index = block_index / 2;
-            uint8_t *bitmap = zone->orders[i].bitmap;
-            bitmap[buddy_index / 8] = FLIP_BIT(bitmap[buddy_index / 8], buddy_index % 8);
+            list_node_t *order_blocks_head = &zone->orders[i].free_blocks_head[j];
+            if (j == migratetype || list_empty(order_blocks_head))
+                continue;
+
+            list_node_t *block = order_blocks_head->next;
+            if (i >= PAGEBLOCK_ORDER)
+            {
+                // Whole pageblocks are free - claim them, so split remainders go to our lists
+                size_t first = ((uint64_t)block - (uint64_t)zone->base_addr) / (PAGE_SIZE << PAGEBLOCK_ORDER);
+                memset(&zone->pageblock_types[first], migratetype, (size_t)1 << (i - PAGEBLOCK_ORDER));
+            }
+
+            return zone_take_block(zone, block, i, order);
         }
+    }
 
-        for (int j = i - 1; j >= order; j--)
-        {
-            size_t block_index = ((uint64_t)curr_split_block - (uint64_t)zone->start_addr) / (((size_t)1 << j) * PAGE_SIZE);
-            size_t buddy_index = block_index / 2;
-            uint8_t *bitmap = zone->orders[j].bitmap;
-            bitmap[buddy_index / 8] = SET_BIT(bitmap[buddy_index / 8], buddy_index % 8);
+    return NULL;
+}
 
-            list_node_t *first_half  = curr_split_block;
-            list_node_t *second_half = (list_node_t*)FLIP_BIT((uint64_t)curr_split_block, 12 + j);
+static void *zone_take_block(allocator_zone_t *zone, list_node_t *block, int block_order, int order)
+{
+    list_extract(block);
+    zone->orders[block_order].count--;
+    zone->free_pages -= (size_t)1 << order;
 
-            list_init(second_half);
-            list_insert_after(&zone->orders[j].free_blocks_head, second_half);
+    if (block_order < MAX_ORDER)
+    {
+        size_t block_index = ((uint64_t)block - (uint64_t)zone->base_addr) / (((size_t)1 << block_order) * PAGE_SIZE);
+        size_t buddy_index = block_index / 2;
+        uint8_t *bitmap = zone->orders[block_order].bitmap;
+        bitmap[buddy_index / 8] = FLIP_BIT(bitmap[buddy_index / 8], buddy_index % 8);
+    }
 
-            curr_split_block = first_half;
-        }
-        
-        memset(curr_split_block, 0, PAGE_SIZE * ((size_t)1 << order));
-        return (void*)curr_split_block;
+    // Split larger block
+    for (int j = block_order - 1; j >= order; j--)
+    {
+        size_t block_index = ((uint64_t)block - (uint64_t)zone->base_addr) / (((size_t)1 << j) * PAGE_SIZE);
+        size_t buddy_index = block_index / 2;
+        uint8_t *bitmap = zone->orders[j].bitmap;
+        bitmap[buddy_index / 8] = SET_BIT(bitmap[buddy_index / 8], buddy_index % 8);
+
+        list_node_t *second_half = (list_node_t*)FLIP_BIT((uint64_t)block, 12 + j);
+
+        list_init(second_half);
+        list_insert_after(&zone->orders[j].free_blocks_head[block_migratetype(zone, (uint64_t)second_half)], second_half);
+        zone->orders[j].count++;
     }
 
-    return NULL;
+    return (void*)block;
 }
 
 static void zone_dealloc(allocator_zone_t *zone, uint64_t addr, int order)
@@ -254,7 +568,7 @@ static void zone_dealloc(allocator_zone_t *zone, uint64_t addr, int order)
     {
         uint64_t buddy_addr = FLIP_BIT(free_block_addr, 12 + free_order);
 
-        size_t block_index = (free_block_addr - (uint64_t)zone->start_addr) / (((size_t)1 << free_order) * PAGE_SIZE);
+        size_t block_index = (free_block_addr - (uint64_t)zone->base_addr) / (((size_t)1 << free_order) * PAGE_SIZE);
         size_t buddy_index = block_index / 2;
         uint8_t *bitmap = zone->orders[free_order].bitmap;
         if (!GET_BIT(bitmap[buddy_index / 8], buddy_index % 8))
@@ -267,6 +581,7 @@ static void zone_dealloc(allocator_zone_t *zone, uint64_t addr, int order)
         // Coalesce
         bitmap[buddy_index / 8] = CLEAR_BIT(bitmap[buddy_index / 8], buddy_index % 8);        
         list_extract((list_node_t*)buddy_addr);
+        zone->orders[free_order].count--;
 
         if (buddy_addr < free_block_addr)
             free_block_addr = buddy_addr;
@@ -277,15 +592,182 @@ static void zone_dealloc(allocator_zone_t *zone, uint64_t addr, int order)
     // Add final free block to the according list
     list_node_t *free_block = (list_node_t*)free_block_addr;
     list_init((list_node_t*)free_block);
-    list_insert_after(&zone->orders[free_order].free_blocks_head, free_block);
+    list_insert_after(&zone->orders[free_order].free_blocks_head[block_migratetype(zone, free_block_addr)], free_block);
+    zone->orders[free_order].count++;
+    zone->free_pages += (size_t)1 << order;
+}
+
+static int block_migratetype(allocator_zone_t *zone, uint64_t addr)
+{
+    return zone->pageblock_types[(addr - (uint64_t)zone->base_addr) / (PAGE_SIZE << PAGEBLOCK_ORDER)];
 }
 
 static int pages2order(size_t pages)
 {
-    kassert_dbg(pages <= (1 << MAX_ORDER));
+    kassert_dbg(pages <= ((size_t)1 << MAX_ORDER));
     int order = 0;
-    while ((1 << order) < (int)pages)
+    while (((size_t)1 << order) < pages)
         order++;
 
     return order;
 }
+
+static void reserve_region(uint64_t start, uint64_t end)
+{
+    kassert(reserved_count < MAX_RESERVED_COUNT);
+
+    // Keep regions sorted by start address
+    size_t pos = reserved_count;
+    while (pos > 0 && (uint64_t)reserved_regions[pos - 1].start > start)
+    {
+        reserved_regions[pos] = reserved_regions[pos - 1];
+        pos--;
+    }
+
+    reserved_regions[pos].start = (void*)ROUNDDOWN(start, PAGE_SIZE);
+    reserved_regions[pos].end   = (void*)ROUNDUP(end, PAGE_SIZE);
+    reserved_count++;
+}
+
+static uint64_t find_unreserved_space(uint64_t start, uint64_t end, size_t size)
+{
+    uint64_t curr = start;
+    for (size_t i = 0; i < reserved_count; i++)
+    {
+        uint64_t reserved_start = (uint64_t)reserved_regions[i].start;
+        uint64_t reserved_end   = (uint64_t)reserved_regions[i].end;
+        if (reserved_end <= curr)
+            continue;
+
+        if (reserved_start >= curr + size)
+            break;
+
+        curr = reserved_end;
+    }
+
+    return curr + size <= end ? curr : 0;
+}
+
+static bool frames_compact(int order)
+{
+    size_t block_size = PAGE_SIZE * ((size_t)1 << order);
+
+    // 1. Find the aligned block which needs the least migrations to become free
+
+    allocator_zone_t *zone = NULL;
+    uint64_t target = 0;
+    int best_cost = -1;
+    for (size_t i = 0; i < zones_count; i++)
+    {
+        allocator_zone_t *curr_zone = &allocator_zones[i];
+        uint64_t addr = ROUNDUP((uint64_t)curr_zone->start_addr, block_size);
+        for (; addr + block_size <= (uint64_t)curr_zone->end_addr; addr += block_size)
+        {
+            int cost = block_migration_cost(curr_zone, addr, addr + block_size);
+            if (cost >= 0 && (best_cost < 0 || cost < best_cost))
+            {
+                zone = curr_zone;
+                target = addr;
+                best_cost = cost;
+            }
+        }
+    }
+
+    if (best_cost <= 0)
+    {
+        // Either nothing can be done or the block is already free
+        return false;
+    }
+
+    // 2. Move every user frame out of the block. Free frames of the block returned by the allocator
+    // are held until the end, so they are not used as migration destinations again
+
+    list_node_t held;
+    list_init(&held);
+
+    bool success = true;
+    uint64_t addr = target;
+    while (addr < target + block_size)
+    {
+        frame_t *desc = &zone->frames[(addr - (uint64_t)zone->start_addr) / PAGE_SIZE];
+        if (desc->pages == 0 || desc->type != FRAME_TYPE_USER)
+        {
+            // Free or already held frame
+            addr += PAGE_SIZE;
+            continue;
+        }
+
+        void *new_frame = frames_alloc_type(1, FRAME_TYPE_USER);
+        while (new_frame != NULL && target <= (uint64_t)new_frame && (uint64_t)new_frame < target + block_size)
+        {
+            frame_desc(new_frame)->type = FRAME_TYPE_KERNEL;
+            type_pages[FRAME_TYPE_USER]--;
+            type_pages[FRAME_TYPE_KERNEL]++;
+            list_init(new_frame);
+            list_insert_after(&held, new_frame);
+            new_frame = frames_alloc_type(1, FRAME_TYPE_USER);
+        }
+
+        if (new_frame == NULL || !vmem_migrate_frame((void*)addr, new_frame))
+        {
+            if (new_frame != NULL)
+                frames_free(new_frame);
+
+            success = false;
+            break;
+        }
+
+        frames_free((void*)addr);
+        addr += PAGE_SIZE;
+    }
+
+    while (!list_empty(&held))
+    {
+        list_node_t *frame = held.next;
+        list_extract(frame);
+        frames_free(frame);
+    }
+
+    return success;
+}
+
+static int block_migration_cost(allocator_zone_t *zone, uint64_t start, uint64_t end)
+{
+    // Allocations are aligned by their size rounded up to the power of two,
+    // so the only allocations covering the block from the outside start at larger aligned blocks
+    for (size_t size = 2 * (end - start); size <= PAGE_SIZE * ((size_t)1 << MAX_ORDER); size *= 2)
+    {
+        uint64_t head = ROUNDDOWN(start, size);
+        if (head == start)
+            continue;
+
+        if (head < (uint64_t)zone->start_addr)
+            break;
+
+        frame_t *desc = &zone->frames[(head - (uint64_t)zone->start_addr) / PAGE_SIZE];
+        if (head + desc->pages * PAGE_SIZE > start)
+            return -1;
+    }
+
+    int cost = 0;
+    uint64_t addr = start;
+    while (addr < end)
+    {
+        frame_t *desc = &zone->frames[(addr - (uint64_t)zone->start_addr) / PAGE_SIZE];
+        if (desc->pages == 0)
+        {
+            addr += PAGE_SIZE;
+            continue;
+        }
+
+        // Only single mapped user pages can be moved
+        if (desc->type != FRAME_TYPE_USER || desc->pages != 1 || desc->refcount != 1 ||
+            (desc->flags & FRAME_PINNED))
+            return -1;
+
+        cost++;
+        addr += PAGE_SIZE;
+    }
+
+    return cost;
+}
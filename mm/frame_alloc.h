@@ -2,6 +2,35 @@
 #define FRAME_ALLOC_H
 
 #include "common.h"
+#include "mm/meminfo.h"
+
+/// Owner of an allocated physical frame
+typedef enum frame_type
+{
+    FRAME_TYPE_FREE    = 0,
+    FRAME_TYPE_KERNEL  = 1,
+    FRAME_TYPE_PGTABLE = 2,
+    FRAME_TYPE_KSTACK  = 3,
+    FRAME_TYPE_OBJ     = 4,
+    FRAME_TYPE_USER    = 5,
+    FRAME_TYPES_COUNT
+} frame_type_t;
+
+// Frame must not be moved to another physical location
+#define FRAME_PINNED (1 << 0)
+
+/// Per-frame descriptor. Fields are maintained for the first frame of an allocation only
+typedef struct frame
+{
+    uint32_t refcount;
+    // Amount of frames in the allocation, 0 if frame is not the first one of an allocation
+    uint32_t pages;
+    uint16_t flags;
+    uint8_t  type;
+    // Direct-mapping address of the page table entry which maps a single page allocated by vmem, 
+    // lets compaction move the frame without walking every address space
+    uint64_t* mapping;
+} frame_t;
 
 /**
  * Initializes frame allocator. Must be called after direct physical memory mapping is created.
@@ -9,12 +38,22 @@
 void frame_alloc_init();
 
 /**
- * Allocates continuous physical memory region.
+ * Allocates continuous physical memory region of exactly specified size. 
+ * Region is aligned by its size rounded up to the power of two, 
+ * so 512 and 262144 frames allocations are suitable for 2MB and 1GB pages respectively
  * 
- * \param size Amount of frames 
+ * \param size Amount of frames, up to 1GB
  */
 void* frames_alloc(size_t size);
 
+/**
+ * Same as frames_alloc, but marks allocated frames with specified owner type
+ * 
+ * \param size Amount of frames, up to 1GB
+ * \param type Owner type
+ */
+void* frames_alloc_type(size_t size, frame_type_t type);
+
 /**
  * Allocates single physical frame. 
  * \return Direct-mapping virtual address of the allocated frame
@@ -22,12 +61,12 @@ void* frames_alloc(size_t size);
 void* frame_alloc();
 
 /**
- * Frees specified amount of physical frames at specified base address
+ * Frees physical frames allocated by frames_alloc at specified base address. 
+ * Size of the region is taken from the frame descriptor
  * 
  * \param addr Base address
- * \param size Amount of frames
  */
-void frames_free(void* addr, size_t size);
+void frames_free(void* addr);
 
 /**
  * Frees single physical frame at specified address
@@ -36,4 +75,54 @@ void frames_free(void* addr, size_t size);
  */
 void frame_free(void* addr);
 
+/**
+ * Returns descriptor of the frame at specified address
+ * 
+ * \param addr Direct-mapping virtual address of the frame
+ * 
+ * \return Frame descriptor or NULL if frame is not managed by the allocator
+ */
+frame_t* frame_desc(void* addr);
+
+/**
+ * Takes additional reference to the allocation at specified base address
+ * 
+ * \param addr Base address
+ */
+void frame_get(void* addr);
+
+/**
+ * Drops reference to the allocation at specified base address. 
+ * Frames are freed when the last reference is dropped
+ * 
+ * \param addr Base address
+ */
+void frame_put(void* addr);
+
+/**
+ * Callback of frame_alloc_walk_free
+ * 
+ * \param block Direct-mapping virtual address of the free block
+ * \param order Block order
+ * \param pair_bit Buddy bitmap bit of the block and its buddy, -1 for max order blocks which have no buddy
+ * \param ctx Context passed to frame_alloc_walk_free
+ */
+typedef void (*frame_walk_fn_t)(void* block, int order, int pair_bit, void* ctx);
+
+/**
+ * Calls given function for every block in the free lists of all zones. 
+ * Used to check allocator consistency
+ * 
+ * \param fn Callback
+ * \param ctx Context passed to the callback
+ */
+void frame_alloc_walk_free(frame_walk_fn_t fn, void* ctx);
+
+/**
+ * Fills frame allocator part of memory statistics
+ * 
+ * \param info Statistics
+ */
+void frame_alloc_meminfo(meminfo_t *info);
+
 #endif
@@ -0,0 +1,50 @@
+#include "kernel/panic.h"
+#include "mm/kmalloc.h"
+#include "mm/obj.h"
+#include "mm/frame_alloc.h"
+
+// Larger allocations are taken from the frame allocator. Page sized objects would waste 
+// a page of every slab on its header, so the largest class still packs several objects per page
+#define KMALLOC_MAX_CACHE_SIZE (3 * KB)
+
+// Size classes in ascending order
+static obj_alloc_t kmalloc_caches[] = {
+    OBJ_ALLOC_INIT(16,   16),
+    OBJ_ALLOC_INIT(32,   32),
+    OBJ_ALLOC_INIT(64,   64),
+    OBJ_ALLOC_INIT(96,   32),
+    OBJ_ALLOC_INIT(128,  64),
+    OBJ_ALLOC_INIT(192,  64),
+    OBJ_ALLOC_INIT(256,  64),
+    OBJ_ALLOC_INIT(512,  64),
+    OBJ_ALLOC_INIT(1024, 64),
+    OBJ_ALLOC_INIT(2048, 64),
+    // AVX-512 XSAVE area is 2696 bytes
+    OBJ_ALLOC_INIT(KMALLOC_MAX_CACHE_SIZE, 64)
+};
+
+void* kmalloc(size_t size)
+{
+    kassert_dbg(size > 0);
+
+    if (size > KMALLOC_MAX_CACHE_SIZE)
+        return frames_alloc(DIV_ROUNDUP(size, PAGE_SIZE));
+
+    size_t i = 0;
+    while (kmalloc_caches[i].obj_size < size)
+        i++;
+
+    return object_alloc(&kmalloc_caches[i]);
+}
+
+void kfree(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    obj_alloc_t *owner = object_owner(ptr);
+    if (owner != NULL)
+        object_free(owner, ptr);
+    else
+        frames_free(ptr);
+}
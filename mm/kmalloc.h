@@ -0,0 +1,24 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include "common.h"
+
+/**
+ * Allocates general purpose kernel memory. 
+ * Small sizes are served by slab caches of fixed size classes, 
+ * larger ones are taken from the frame allocator directly
+ * 
+ * \param size Size in bytes
+ * 
+ * \return Virtual address or NULL if out of memory
+ */
+void* kmalloc(size_t size);
+
+/**
+ * Frees memory allocated by kmalloc. NULL is ignored
+ * 
+ * \param ptr Virtual address
+ */
+void kfree(void* ptr);
+
+#endif
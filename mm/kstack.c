@@ -0,0 +1,94 @@
+#include "kernel/panic.h"
+#include "mm/kstack.h"
+#include "mm/frame_alloc.h"
+#include "mm/vmem.h"
+
+// Every slot starts with a guard page
+#define KSTACK_SLOT_SIZE (KSTACK_SIZE + PAGE_SIZE)
+
+_Static_assert((uint64_t)KSTACK_MAX_COUNT * KSTACK_SLOT_SIZE <= KERNEL_STACKS_SIZE, "kernel stacks region is too small");
+
+static bool region_shared = false;
+
+static uint64_t slots_used[KSTACK_MAX_COUNT / 64] = {};
+static size_t slots_hint = 0;
+
+static void* cache[KSTACK_CACHE_SIZE];
+static size_t cache_count = 0;
+
+static uint8_t* kstack_slot_bottom(size_t slot);
+static void kstack_unmap(uint8_t* bottom, size_t pgcnt);
+
+void* kstack_alloc()
+{
+    if (cache_count > 0)
+        return cache[--cache_count];
+
+    if (!region_shared)
+    {
+        if (vmem_share_region((void*)KERNEL_STACKS_START) < 0)
+            return NULL;
+
+        region_shared = true;
+    }
+
+    size_t slot = slots_hint;
+    while (slots_used[slot / 64] & (1ull << (slot % 64)))
+    {
+        slot = (slot + 1) % KSTACK_MAX_COUNT;
+        if (slot == slots_hint)
+            return NULL;
+    }
+
+    // Frames don't have to be contiguous, frame_free is called on unmap
+    uint8_t* bottom = kstack_slot_bottom(slot);
+    for (size_t i = 0; i < KSTACK_PAGES; i++)
+    {
+        void* frame = frames_alloc_type(1, FRAME_TYPE_KSTACK);
+        if (frame == NULL)
+        {
+            kstack_unmap(bottom, i);
+            return NULL;
+        }
+
+        int err = vmem_map_kernel_page(bottom + i * PAGE_SIZE, VIRT_TO_PHYS(frame), VMEM_WRITE | VMEM_ALLOC);
+        if (err < 0)
+        {
+            frame_free(frame);
+            kstack_unmap(bottom, i);
+            return NULL;
+        }
+    }
+
+    slots_used[slot / 64] |= 1ull << (slot % 64);
+    slots_hint = (slot + 1) % KSTACK_MAX_COUNT;
+    return bottom + KSTACK_SIZE;
+}
+
+void kstack_free(void* top)
+{
+    uint8_t* bottom = (uint8_t*)top - KSTACK_SIZE;
+    size_t slot = ((uint64_t)bottom - KERNEL_STACKS_START) / KSTACK_SLOT_SIZE;
+    kassert_dbg(kstack_slot_bottom(slot) == bottom);
+    kassert_dbg(slots_used[slot / 64] & (1ull << (slot % 64)));
+
+    if (cache_count < KSTACK_CACHE_SIZE)
+    {
+        cache[cache_count++] = top;
+        return;
+    }
+
+    kstack_unmap(bottom, KSTACK_PAGES);
+    slots_used[slot / 64] &= ~(1ull << (slot % 64));
+}
+
+static uint8_t* kstack_slot_bottom(size_t slot)
+{
+    return (uint8_t*)KERNEL_STACKS_START + slot * KSTACK_SLOT_SIZE + PAGE_SIZE;
+}
+
+static void kstack_unmap(uint8_t* bottom, size_t pgcnt)
+{
+    for (size_t i = 0; i < pgcnt; i++)
+        vmem_unmap_kernel_page(bottom + i * PAGE_SIZE);
+}
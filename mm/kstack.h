@@ -0,0 +1,35 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include "common.h"
+#include "mm/mem_layout.h"
+
+// Stack size in pages, can be overridden at build time
+#ifndef KSTACK_PAGES
+#define KSTACK_PAGES 4
+#endif
+
+#define KSTACK_SIZE (KSTACK_PAGES * PAGE_SIZE)
+
+// One stack per task at most
+#define KSTACK_MAX_COUNT (1 << 16)
+
+// Freed stacks kept mapped for reuse
+#define KSTACK_CACHE_SIZE 16
+
+/**
+ * Allocates kernel stack in the kernel stacks region, the page below the stack is left unmapped. 
+ * Stack contents are undefined
+ * 
+ * \return Stack top or NULL
+ */
+void* kstack_alloc();
+
+/**
+ * Frees kernel stack allocated by kstack_alloc
+ * 
+ * \param top Stack top
+ */
+void kstack_free(void* top);
+
+#endif
@@ -11,4 +11,8 @@
 #define KERNEL_DIRECT_PHYS_MAPPING_START 0xffff888000000000
 #define KERNEL_DIRECT_PHYS_MAPPING_SIZE  64 * (1ull << 40)
 
+// Kernel stacks separated by unmapped guard pages, covers a single PML4 entry
+#define KERNEL_STACKS_START 0xffffc90000000000
+#define KERNEL_STACKS_SIZE  (1ull << 39)
+
 #endif
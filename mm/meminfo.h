@@ -0,0 +1,60 @@
+#ifndef MEMINFO_H
+#define MEMINFO_H
+
+#include <stdint.h>
+
+// Incremented whenever layout of meminfo_t changes
+#define MEMINFO_VERSION 1
+
+#define MEMINFO_MAX_ZONES  16
+#define MEMINFO_MAX_ORDERS 19
+#define MEMINFO_MAX_CACHES 32
+#define MEMINFO_MAX_TYPES  8
+
+typedef struct meminfo_zone
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t node;
+    uint64_t total_pages;
+    uint64_t free_pages;
+    // Amount of free blocks of each order
+    uint64_t free_blocks[MEMINFO_MAX_ORDERS];
+} meminfo_zone_t;
+
+typedef struct meminfo_cache
+{
+    uint64_t obj_size;
+    uint64_t obj_stride;
+    uint64_t slabs;
+    uint64_t slab_pages;
+    // Objects taken from slabs, including ones cached in magazines
+    uint64_t objs_inuse;
+    uint64_t objs_total;
+} meminfo_cache_t;
+
+/// Memory statistics reported by SYS_MEMINFO
+typedef struct meminfo
+{
+    // Filled by the kernel
+    uint32_t version;
+    uint32_t size;
+
+    uint64_t total_pages;
+    uint64_t free_pages;
+    // Allocated frames by owner type, indexed by frame_type_t
+    uint64_t type_pages[MEMINFO_MAX_TYPES];
+
+    // Page faults resolved by allocating a frame
+    uint64_t page_faults;
+    // Frames copied when address spaces are cloned
+    uint64_t pages_copied;
+
+    uint64_t zones_count;
+    meminfo_zone_t zones[MEMINFO_MAX_ZONES];
+
+    uint64_t caches_count;
+    meminfo_cache_t caches[MEMINFO_MAX_CACHES];
+} meminfo_t;
+
+#endif
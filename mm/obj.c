@@ -1,42 +1,388 @@
 #include "kernel/panic.h"
 #include "obj.h"
 #include "mm/frame_alloc.h"
+#include "arch/x86/arch.h"
+
+// Slabs are enlarged until they fit at least this amount of objects
+#define SLAB_MIN_OBJECTS 8
+#define MAX_SLAB_ORDER   3
+
+// Amount of empty slabs each allocator keeps instead of returning them immediately
+#define SLAB_MAX_SPARE 2
+
+/// Header at the beginning of every slab
+typedef struct slab
+{
+    // Node in the list of partial or empty slabs. Full slabs are not linked anywhere
+    list_node_t node;
+    obj_alloc_t *alloc;
+    void* next_free;
+    uint32_t inuse;
+} slab_t;
+
+// Magazine occupies two cache lines
+#define MAGAZINE_SIZE 13
+
+/// Stack of free objects cached by a CPU
+typedef struct obj_magazine
+{
+    // Node in the depot list
+    list_node_t node;
+    size_t rounds;
+    void* objs[MAGAZINE_SIZE];
+} obj_magazine_t;
+
+static void obj_cache_init(obj_alloc_t *alloc);
+static void *slab_alloc(obj_alloc_t *alloc);
+static void slab_free(obj_alloc_t *alloc, void *obj);
+static obj_magazine_t *depot_take(list_node_t *list);
+static void depot_flush(obj_alloc_t *alloc);
+static size_t slab_capacity(obj_alloc_t *alloc, size_t pages);
+static size_t slab_colour_step(obj_alloc_t *alloc);
+static slab_t *slab_create(obj_alloc_t *alloc);
+static slab_t *slab_by_obj(void *obj);
+
+// Initialized allocators
+static list_node_t obj_allocs = { &obj_allocs, &obj_allocs };
+
+// Magazines themselves are taken directly from slabs
+static obj_alloc_t magazine_alloc = {
+    .obj_size = sizeof(obj_magazine_t),
+    .align    = CACHE_LINE_SIZE_BYTES,
+    .flags    = OBJ_NO_MAGAZINES
+};
 
 void* object_alloc(obj_alloc_t* alloc)
 {
     kassert_dbg(alloc != NULL);
-    kassert(alloc->obj_size <= PAGE_SIZE);
 
-    if (alloc->next_free == NULL)
+    if (alloc->slab_pages == 0)
+        obj_cache_init(alloc);
+
+    if (alloc->flags & OBJ_NO_MAGAZINES)
+        return slab_alloc(alloc);
+
+    obj_cpu_cache_t *cpu = &alloc->cpus[arch_cpu_index()];
+
+    // Fast path - only CPU-local memory is touched
+    if (cpu->loaded != NULL && cpu->loaded->rounds > 0)
+        return cpu->loaded->objs[--cpu->loaded->rounds];
+
+    if (cpu->previous != NULL && cpu->previous->rounds > 0)
     {
-        // Request another page of memory
-        void *page = frame_alloc();
+        obj_magazine_t *tmp = cpu->loaded;
+        cpu->loaded   = cpu->previous;
+        cpu->previous = tmp;
+        return cpu->loaded->objs[--cpu->loaded->rounds];
+    }
+
+    // Both magazines are empty, exchange one of them for a full one from the depot
+    obj_magazine_t *full = depot_take(&alloc->depot_full);
+    if (full == NULL)
+        return slab_alloc(alloc);
+
+    if (cpu->previous != NULL)
+        list_insert_after(&alloc->depot_empty, &cpu->previous->node);
 
-        uint64_t curr = (uint64_t)page;
-        uint64_t end = curr + PAGE_SIZE;
+    cpu->previous = cpu->loaded;
+    cpu->loaded   = full;
+    return cpu->loaded->objs[--cpu->loaded->rounds];
+}
+
+void object_free(obj_alloc_t* alloc, void* obj)
+{
+    kassert_dbg(alloc != NULL);
+    kassert_dbg(obj != NULL);
+    kassert_dbg(object_owner(obj) == alloc);
+
+    if (alloc->flags & OBJ_NO_MAGAZINES)
+    {
+        slab_free(alloc, obj);
+        return;
+    }
+
+    obj_cpu_cache_t *cpu = &alloc->cpus[arch_cpu_index()];
+
+    // Fast path - only CPU-local memory is touched
+    if (cpu->loaded != NULL && cpu->loaded->rounds < MAGAZINE_SIZE)
+    {
+        cpu->loaded->objs[cpu->loaded->rounds++] = obj;
+        return;
+    }
+
+    if (cpu->previous != NULL && cpu->previous->rounds == 0)
+    {
+        obj_magazine_t *tmp = cpu->loaded;
+        cpu->loaded   = cpu->previous;
+        cpu->previous = tmp;
+        cpu->loaded->objs[cpu->loaded->rounds++] = obj;
+        return;
+    }
 
-        uint64_t prev = 0;
-        while (curr + alloc->obj_size <= end)
+    // Both magazines are full (or missing), exchange one of them for an empty one
+    obj_magazine_t *empty = depot_take(&alloc->depot_empty);
+    if (empty == NULL)
+    {
+        empty = slab_alloc(&magazine_alloc);
+        if (empty == NULL)
         {
-            *(uint64_t*)curr = prev;
-            prev = curr;
+            slab_free(alloc, obj);
+            return;
+        }
+
+        empty->rounds = 0;
+    }
+
+    if (cpu->previous != NULL)
+        list_insert_after(&alloc->depot_full, &cpu->previous->node);
+
+    cpu->previous = cpu->loaded;
+    cpu->loaded   = empty;
+    cpu->loaded->objs[cpu->loaded->rounds++] = obj;
+}
+
+obj_alloc_t* object_owner(void* obj)
+{
+    slab_t *slab = slab_by_obj(obj);
+    return slab != NULL ? slab->alloc : NULL;
+}
+
+size_t object_shrink()
+{
+    // Slabs freed anywhere below, including depot_flush, are counted by the difference
+    size_t pages_before = 0;
+    for (list_node_t *node = obj_allocs.next; node != &obj_allocs; node = node->next)
+    {
+        obj_alloc_t *alloc = (obj_alloc_t*)node;
+        pages_before += alloc->slabs_count * alloc->slab_pages;
+    }
+
+    // Magazines loaded by CPUs are left intact, only the depots are drained
+    for (list_node_t *node = obj_allocs.next; node != &obj_allocs; node = node->next)
+    {
+        obj_alloc_t *alloc = (obj_alloc_t*)node;
+        if (!(alloc->flags & OBJ_NO_MAGAZINES))
+            depot_flush(alloc);
+    }
 
-            curr += ROUNDUP(alloc->obj_size, CACHE_LINE_SIZE_BYTES);
+    size_t pages_after = 0;
+    for (list_node_t *node = obj_allocs.next; node != &obj_allocs; node = node->next)
+    {
+        obj_alloc_t *alloc = (obj_alloc_t*)node;
+        while (!list_empty(&alloc->empty))
+        {
+            list_node_t *spare = alloc->empty.next;
+            list_extract(spare);
+            frames_free(spare);
+            alloc->slabs_count--;
         }
 
-        alloc->next_free = (void*)prev;
+        alloc->empty_count = 0;
+        pages_after += alloc->slabs_count * alloc->slab_pages;
+    }
+
+    return pages_before - pages_after;
+}
+
+void object_meminfo(meminfo_t *info)
+{
+    kassert_dbg(info != NULL);
+
+    info->caches_count = 0;
+    for (list_node_t *node = obj_allocs.next; node != &obj_allocs; node = node->next)
+    {
+        if (info->caches_count == MEMINFO_MAX_CACHES)
+            break;
+
+        obj_alloc_t *alloc = (obj_alloc_t*)node;
+        meminfo_cache_t *cache_info = &info->caches[info->caches_count++];
+
+        cache_info->obj_size   = alloc->obj_size;
+        cache_info->obj_stride = alloc->obj_stride;
+        cache_info->slabs      = alloc->slabs_count;
+        cache_info->slab_pages = alloc->slab_pages;
+        cache_info->objs_inuse = alloc->objs_inuse;
+        cache_info->objs_total = alloc->slabs_count * alloc->slab_capacity;
     }
+}
+
+static void *slab_alloc(obj_alloc_t *alloc)
+{
+    if (alloc->slab_pages == 0)
+        obj_cache_init(alloc);
+
+    if (list_empty(&alloc->partial))
+    {
+        if (!list_empty(&alloc->empty))
+        {
+            list_node_t *spare = alloc->empty.next;
+            list_extract(spare);
+            list_insert_after(&alloc->partial, spare);
+            alloc->empty_count--;
+        }
+        else if (slab_create(alloc) == NULL)
+            return NULL;
+    }
+
+    slab_t *slab = (slab_t*)alloc->partial.next;
+
+    void *obj = slab->next_free;
+    slab->next_free = *(void**)obj;
+    slab->inuse++;
+    alloc->objs_inuse++;
+
+    // Full slab is found again by the address of an object being freed
+    if (slab->next_free == NULL)
+        list_extract(&slab->node);
 
-    void *obj = alloc->next_free;
-    alloc->next_free = (void*)*(uint64_t*)alloc->next_free;
     return obj;
 }
 
-void object_free(obj_alloc_t* alloc, void* obj)
+static void slab_free(obj_alloc_t *alloc, void *obj)
 {
-    kassert_dbg(alloc != NULL);
-    kassert_dbg(obj != NULL);
+    slab_t *slab = slab_by_obj(obj);
+    kassert(slab != NULL && slab->alloc == alloc);
+
+    if (slab->next_free == NULL)
+        list_insert_after(&alloc->partial, &slab->node);
+
+    *(void**)obj = slab->next_free;
+    slab->next_free = obj;
+    slab->inuse--;
+    alloc->objs_inuse--;
+
+    if (slab->inuse == 0)
+    {
+        list_extract(&slab->node);
+        if (alloc->empty_count < SLAB_MAX_SPARE)
+        {
+            list_insert_after(&alloc->empty, &slab->node);
+            alloc->empty_count++;
+        }
+        else
+        {
+            frames_free(slab);
+            alloc->slabs_count--;
+        }
+    }
+}
+
+static void obj_cache_init(obj_alloc_t *alloc)
+{
+    kassert(alloc->align != 0 && (alloc->align & (alloc->align - 1)) == 0);
+
+    // Free objects hold the free list pointer
+    if (alloc->align < sizeof(void*))
+        alloc->align = sizeof(void*);
+
+    alloc->obj_stride = ROUNDUP(alloc->obj_size < sizeof(void*) ? sizeof(void*) : alloc->obj_size, alloc->align);
+
+    alloc->slab_pages = 1;
+    while (slab_capacity(alloc, alloc->slab_pages) < SLAB_MIN_OBJECTS &&
+           alloc->slab_pages < (1 << MAX_SLAB_ORDER))
+        alloc->slab_pages *= 2;
+
+    alloc->slab_capacity = slab_capacity(alloc, alloc->slab_pages);
+    kassert(alloc->slab_capacity > 0);
+
+    // Space left after the last object is used for colouring
+    size_t leftover = alloc->slab_pages * PAGE_SIZE - ROUNDUP(sizeof(slab_t), alloc->align) -
+                      alloc->slab_capacity * alloc->obj_stride;
+
+    alloc->colours     = leftover / slab_colour_step(alloc) + 1;
+    alloc->colour_next = 0;
+
+    list_init(&alloc->partial);
+    list_init(&alloc->empty);
+    alloc->empty_count = 0;
+    list_init(&alloc->depot_full);
+    list_init(&alloc->depot_empty);
+    list_insert_after(&obj_allocs, &alloc->node);
+}
+
+static size_t slab_capacity(obj_alloc_t *alloc, size_t pages)
+{
+    size_t objs_offset = ROUNDUP(sizeof(slab_t), alloc->align);
+    if (objs_offset >= pages * PAGE_SIZE)
+        return 0;
+
+    return (pages * PAGE_SIZE - objs_offset) / alloc->obj_stride;
+}
+
+static size_t slab_colour_step(obj_alloc_t *alloc)
+{
+    // Colour offsets keep objects aligned
+    return alloc->align > CACHE_LINE_SIZE_BYTES ? alloc->align : CACHE_LINE_SIZE_BYTES;
+}
+
+static slab_t *slab_create(obj_alloc_t *alloc)
+{
+    // Slab size is a power of two, so the slab is aligned by its size
+    slab_t *slab = frames_alloc_type(alloc->slab_pages, FRAME_TYPE_OBJ);
+    if (slab == NULL)
+        return NULL;
+
+    slab->alloc = alloc;
+    slab->inuse = 0;
+    alloc->slabs_count++;
+
+    uint64_t curr = ROUNDUP((uint64_t)slab + sizeof(slab_t), alloc->align) +
+                    alloc->colour_next * slab_colour_step(alloc);
+
+    alloc->colour_next = (alloc->colour_next + 1) % alloc->colours;
+    void **link = &slab->next_free;
+    for (size_t i = 0; i < alloc->slab_capacity; i++)
+    {
+        *link = (void*)curr;
+        link = (void**)curr;
+        curr += alloc->obj_stride;
+    }
+
+    *link = NULL;
+
+    list_insert_after(&alloc->partial, &slab->node);
+    return slab;
+}
+
+static slab_t *slab_by_obj(void *obj)
+{
+    // Slab head is the nearest aligned frame whose descriptor covers the object
+    for (int order = 0; order <= MAX_SLAB_ORDER; order++)
+    {
+        void *head = ROUNDDOWN(obj, PAGE_SIZE << order);
+
+        frame_t *desc = frame_desc(head);
+        if (desc == NULL)
+            return NULL;
+
+        if (desc->type == FRAME_TYPE_OBJ && desc->pages == (1u << order))
+            return (slab_t*)head;
+    }
+
+    return NULL;
+}
+
+static obj_magazine_t *depot_take(list_node_t *list)
+{
+    if (list_empty(list))
+        return NULL;
+
+    list_node_t *node = list->next;
+    list_extract(node);
+    return (obj_magazine_t*)node;
+}
+
+static void depot_flush(obj_alloc_t *alloc)
+{
+    obj_magazine_t *magazine = NULL;
+    while ((magazine = depot_take(&alloc->depot_full)) != NULL)
+    {
+        for (size_t i = 0; i < magazine->rounds; i++)
+            slab_free(alloc, magazine->objs[i]);
+
+        slab_free(&magazine_alloc, magazine);
+    }
 
-    *(uint64_t*)obj = 0;
-    alloc->next_free = obj;
+    while ((magazine = depot_take(&alloc->depot_empty)) != NULL)
+        slab_free(&magazine_alloc, magazine);
 }
@@ -2,30 +2,109 @@
 #define OBJ_H
 
 #include "common.h"
+#include "utils/list.h"
+#include "arch/x86/arch.h"
+#include "mm/meminfo.h"
 
+// Allocator doesn't cache objects in per-CPU magazines
+#define OBJ_NO_MAGAZINES (1 << 0)
+
+struct obj_magazine;
+
+/// Per-CPU part of an object allocator
+typedef struct obj_cpu_cache
+{
+    // Magazine objects are taken from and returned to
+    struct obj_magazine *loaded;
+    // Previously loaded magazine, which is either full or empty
+    struct obj_magazine *previous;
+} __attribute__((aligned(CACHE_LINE_SIZE_BYTES))) obj_cpu_cache_t;
+
+/// Cache of equally sized objects. Objects are carved from slabs of contiguous frames. 
+/// Freed objects are cached in per-CPU magazines and the depot before returning to slabs
 typedef struct obj_alloc
 {
-    // Linked list of free objects
-    void* next_free;
+    // Node in the list of all the allocators
+    list_node_t node;
+    // Slabs which have both free and used objects
+    list_node_t partial;
+    // Completely free slabs kept to avoid thrashing
+    list_node_t empty;
+    size_t empty_count;
     size_t obj_size;
+    size_t align;
+    uint32_t flags;
+
+    // Following fields are computed on the first allocation
+    size_t obj_stride;
+    size_t slab_pages;
+    size_t slab_capacity;
+    // Slabs shift their objects by different offsets to spread them across cache sets
+    size_t colours;
+    size_t colour_next;
+
+    // Statistics
+    size_t slabs_count;
+    // Objects taken from slabs, including ones cached in magazines
+    size_t objs_inuse;
+
+    // Full and empty magazines exchanged with CPU caches
+    list_node_t depot_full;
+    list_node_t depot_empty;
+    obj_cpu_cache_t cpus[MAX_CPU_COUNT];
 } obj_alloc_t;
 
-// Creates allocator for specified type of objects
-#define OBJ_ALLOC_DEFINE(var, type) obj_alloc_t var = { .next_free = NULL, .obj_size = sizeof(type) }
+// Initializer for allocator of objects of specified size and alignment
+#define OBJ_ALLOC_INIT(size, alignment) { .obj_size = (size), .align = (alignment) }
+
+// Creates allocator for specified type of objects. Objects are naturally aligned and tightly packed
+#define OBJ_ALLOC_DEFINE(var, type) obj_alloc_t var = OBJ_ALLOC_INIT(sizeof(type), _Alignof(type))
+
+// Same as OBJ_ALLOC_DEFINE, but with explicit alignment, e.g. CACHE_LINE_SIZE_BYTES 
+// for frequently written objects which must not share cache lines
+#define OBJ_ALLOC_DEFINE_ALIGNED(var, type, alignment) obj_alloc_t var = OBJ_ALLOC_INIT(sizeof(type), alignment)
 
 /**
  * Allocates single object and returns its virtual address.
  * 
  * \param alloc Object allocator
+ * 
+ * \return Object or NULL if out of memory
  */
 void* object_alloc(obj_alloc_t* alloc);
 
 /**
- * Frees object associated with given allocator
+ * Frees object associated with given allocator. 
+ * Slab is returned to the frame allocator once all its objects are freed, 
+ * unless the allocator has less than a few spare slabs
  * 
  * \param alloc Object allocator
  * \param obj Object
  */
 void object_free(obj_alloc_t* alloc, void* obj);
 
+/**
+ * Finds allocator which owns specified object
+ * 
+ * \param obj Virtual address
+ * 
+ * \return Object allocator or NULL if address doesn't belong to any slab
+ */
+obj_alloc_t* object_owner(void* obj);
+
+/**
+ * Returns spare slabs of all the allocators to the frame allocator. 
+ * Called by the frame allocator under memory pressure
+ * 
+ * \return Amount of released frames
+ */
+size_t object_shrink();
+
+/**
+ * Fills object allocators part of memory statistics
+ * 
+ * \param info Statistics
+ */
+void object_meminfo(meminfo_t *info);
+
 #endif
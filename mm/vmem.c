@@ -1,4 +1,5 @@
 #include "arch/x86/x86.h"
+#include "arch/x86/simd.h"
 #include "kernel/panic.h"
 #include "mm/vmem.h"
 #include "mm/frame_alloc.h"
@@ -8,12 +9,25 @@ OBJ_ALLOC_DEFINE(vmem_area_alloc, vmem_area_t);
 
 static vmem_t *curr_vmem = NULL;
 
+// All initialized address spaces
+static list_node_t vmem_list = { .next = &vmem_list, .prev = &vmem_list };
+
+// Holds top-level entries of the kernel regions shared by all address spaces. 
+// Their lower-level tables are linked into every PML4, not copied
+static vmem_t kernel_vmem = {};
+
+// Statistics
+static size_t page_faults  = 0;
+static size_t pages_copied = 0;
+
 static uint64_t vmem_convert_flags(uint64_t flags);
 static uint64_t vmem_unconvert_flags(uint64_t flags);
 static bool vmem_intersects(vmem_t* vm, uint64_t other_start_addr, uint64_t other_size);
-static void vmem_unmap_page (vmem_t* vm, void* virt_addr);
 static void* vmem_ensure_next_table(pte_t* tbl, size_t idx, uint64_t raw_flags);
 static int vmem_clone_pages(vmem_t* dst, pml4_t* src_pml4);
+static bool vmem_map_huge_page(vmem_t* vm, vmem_area_t* area, void* fault_addr);
+static int vmem_clone_huge_page(vmem_t* dst, uint64_t virt_addr, pte_t src_pte, size_t size);
+static bool vmem_is_shared(size_t pml4ei);
 
 int vmem_alloc_pages(vmem_t* vm, void* virt_addr, size_t pgcnt, uint64_t flags)
 {
@@ -67,7 +81,7 @@ void vmem_free_pages(vmem_t* vm, void* virt_addr, size_t pgcnt)
 
 int vmem_init(vmem_t* vm)
 {
-    vm->pml4 = frame_alloc();
+    vm->pml4 = frames_alloc_type(1, FRAME_TYPE_PGTABLE);
     if (vm->pml4 == NULL)
         return -ENOMEM;
 
@@ -76,6 +90,15 @@ int vmem_init(vmem_t* vm)
         return -ENOMEM;
 
     list_init(&vm->areas_list->node);
+
+    if (kernel_vmem.pml4 != NULL)
+    {
+        for (size_t pml4ei = 256; pml4ei < 512; pml4ei++)
+            vm->pml4->entries[pml4ei] = kernel_vmem.pml4->entries[pml4ei];
+    }
+
+    list_init(&vm->node);
+    list_insert_after(&vmem_list, &vm->node);
     return 0;
 }
 
@@ -134,6 +157,8 @@ void vmem_switch_to(vmem_t* vm)
 void vmem_destroy(vmem_t* vm)
 {
     kassert(curr_vmem != vm);
+
+    list_extract(&vm->node);
     
     // Free areas list
     while (!list_empty(&vm->areas_list->node))
@@ -149,7 +174,7 @@ void vmem_destroy(vmem_t* vm)
     for (size_t pml4ei = 0; pml4ei < 512; pml4ei++)
     {
         pte_t pml4e = vm->pml4->entries[pml4ei];
-        if (!(pml4e & PTE_PRESENT))
+        if (!(pml4e & PTE_PRESENT) || vmem_is_shared(pml4ei))
             continue;
 
         pdpt_t *pdpt = PHYS_TO_VIRT(PTE_ADDR(pml4e));
@@ -161,7 +186,10 @@ void vmem_destroy(vmem_t* vm)
 
             if (pdpte & PTE_PAGE_SIZE)
             {
-                // 1GB pages are not allocated by vmem_alloc_pages
+                // 1GB page - free it only if it's allocated by vmem_alloc_pages
+                if (pdpte & PTE_ALLOC)
+                    frames_free(PHYS_TO_VIRT(PTE_ADDR(pdpte)));
+
                 continue;
             }
 
@@ -174,7 +202,10 @@ void vmem_destroy(vmem_t* vm)
 
                 if (pde & PTE_PAGE_SIZE)
                 {
-                    // 2MB pages are not allocated by vmem_alloc_pages
+                    // 2MB page - free it only if it's allocated by vmem_alloc_pages
+                    if (pde & PTE_ALLOC)
+                        frames_free(PHYS_TO_VIRT(PTE_ADDR(pde)));
+
                     continue;
                 }
 
@@ -223,9 +254,59 @@ int vmem_map_page(vmem_t* vm, void* virt_addr, void* frame, uint64_t flags)
 
     kassert(!(pgtbl->entries[PTE_FROM_ADDR(virt_addr)] & PTE_PRESENT));
     pgtbl->entries[PTE_FROM_ADDR(virt_addr)] = (uint64_t)frame | PTE_PRESENT | flags;
+
+    // Frames allocated by vmem are mapped once, remember where for vmem_migrate_frame
+    if (flags & PTE_ALLOC)
+    {
+        frame_t *desc = frame_desc(PHYS_TO_VIRT(frame));
+        if (desc != NULL)
+            desc->mapping = &pgtbl->entries[PTE_FROM_ADDR(virt_addr)];
+    }
+
+    return 0;
+}
+
+int vmem_share_region(void* virt_addr)
+{
+    size_t pml4ei = PML4E_FROM_ADDR(virt_addr);
+    kassert(pml4ei >= 256);
+
+    if (kernel_vmem.pml4 == NULL)
+    {
+        kernel_vmem.pml4 = frames_alloc_type(1, FRAME_TYPE_PGTABLE);
+        if (kernel_vmem.pml4 == NULL)
+            return -ENOMEM;
+    }
+
+    if (vmem_is_shared(pml4ei))
+        return 0;
+
+    if (vmem_ensure_next_table(kernel_vmem.pml4->entries, pml4ei, PTE_WRITEABLE) == NULL)
+        return -ENOMEM;
+
+    // Link the region into existing address spaces and the boot one, which may be active now
+    pte_t pml4e = kernel_vmem.pml4->entries[pml4ei];
+    list_node_t *vm_node = vmem_list.next;
+    for (; vm_node != &vmem_list; vm_node = vm_node->next)
+        ((vmem_t*)vm_node)->pml4->entries[pml4ei] = pml4e;
+
+    ((pml4_t*)PHYS_TO_VIRT(x86_read_cr3()))->entries[pml4ei] = pml4e;
     return 0;
 }
 
+int vmem_map_kernel_page(void* virt_addr, void* frame, uint64_t flags)
+{
+    kassert_dbg(vmem_is_shared(PML4E_FROM_ADDR(virt_addr)));
+    return vmem_map_page(&kernel_vmem, virt_addr, frame, flags);
+}
+
+void vmem_unmap_kernel_page(void* virt_addr)
+{
+    kassert_dbg(vmem_is_shared(PML4E_FROM_ADDR(virt_addr)));
+    vmem_unmap_page(&kernel_vmem, virt_addr);
+    x86_invlpg(virt_addr);
+}
+
 int vmem_map_page_2mb(vmem_t* vm, void* virt_addr, void* frame, uint64_t flags)
 {
     kassert_dbg(((uint64_t)virt_addr & (~(2 * MB - 1))) == (uint64_t)virt_addr);
@@ -279,16 +360,43 @@ vmem_area_t *vmem_is_mapped(vmem_t* vm, void* addr)
     return NULL;
 }
 
-bool vmem_handle_pf(void* fault_addr)
+bool vmem_migrate_frame(void* old_frame, void* new_frame)
+{
+    frame_t *old_desc = frame_desc(old_frame);
+    frame_t *new_desc = frame_desc(new_frame);
+    kassert_dbg(old_desc != NULL && new_desc != NULL);
+
+    pte_t* pte = old_desc->mapping;
+    if (pte == NULL || !(*pte & PTE_PRESENT) || !(*pte & PTE_ALLOC) || PTE_ADDR(*pte) != VIRT_TO_PHYS(old_frame))
+        return false;
+
+    copy_page(new_frame, old_frame);
+    *pte = (uint64_t)VIRT_TO_PHYS(new_frame) | (*pte & PTE_FLAGS_MASK);
+    new_desc->mapping = pte;
+    old_desc->mapping = NULL;
+
+    // Owner address space isn't known, other ones are flushed when switched to
+    x86_write_cr3(x86_read_cr3());
+    return true;
+}
+
+__hot bool vmem_handle_pf(void* fault_addr)
 {
     vmem_area_t *area = vmem_is_mapped(curr_vmem, fault_addr);
     if (!area)
         return false;
 
-    void* frame = VIRT_TO_PHYS(frame_alloc());
+    page_faults++;
+
+    if ((area->flags & VMEM_HUGE) && vmem_map_huge_page(curr_vmem, area, fault_addr))
+        return true;
+
+    void* frame = frames_alloc_type(1, FRAME_TYPE_USER);
     if (!frame)
         panic("Can't map page: out of memory");
 
+    frame = VIRT_TO_PHYS(frame);
+
     int status = vmem_map_page(curr_vmem, ROUNDDOWN(fault_addr, PAGE_SIZE), frame, area->flags | VMEM_ALLOC);
     if (status < 0)
         panic("Can't map page: %i", status);
@@ -343,7 +451,7 @@ static bool vmem_intersects(vmem_t* vm, uint64_t other_start_addr, uint64_t othe
     return false;
 }
 
-static void vmem_unmap_page(vmem_t* vm, void* virt_addr)
+void vmem_unmap_page(vmem_t* vm, void* virt_addr)
 {
     uint64_t pml4e = vm->pml4->entries[PML4E_FROM_ADDR(virt_addr)];
     if (!(pml4e & PTE_PRESENT))
@@ -354,14 +462,34 @@ static void vmem_unmap_page(vmem_t* vm, void* virt_addr)
     if (!(pdpe & PTE_PRESENT))
         return;
 
+    if (pdpe & PTE_PAGE_SIZE)
+    {
+        // Whole 1GB page goes away on the first unmap inside it
+        if (pdpe & PTE_ALLOC)
+            frames_free(PHYS_TO_VIRT(PTE_ADDR(pdpe)));
+
+        pdpt->entries[PDPE_FROM_ADDR(virt_addr)] = 0;
+        return;
+    }
+
     pgdir_t* pgdir = PHYS_TO_VIRT(PTE_ADDR(pdpe));
     uint64_t pde = pgdir->entries[PDE_FROM_ADDR(virt_addr)];
     if (!(pde & PTE_PRESENT))
         return;
 
+    if (pde & PTE_PAGE_SIZE)
+    {
+        // Same for 2MB pages
+        if (pde & PTE_ALLOC)
+            frames_free(PHYS_TO_VIRT(PTE_ADDR(pde)));
+
+        pgdir->entries[PDE_FROM_ADDR(virt_addr)] = 0;
+        return;
+    }
+
     pgtbl_t* pgtbl = PHYS_TO_VIRT(PTE_ADDR(pde));
     pte_t pte = pgtbl->entries[PTE_FROM_ADDR(virt_addr)];
-    if (pte & VMEM_ALLOC)
+    if (pte & PTE_ALLOC)
         frame_free(PHYS_TO_VIRT(PTE_ADDR(pte)));
 
     pgtbl->entries[PTE_FROM_ADDR(virt_addr)] = 0;
@@ -378,11 +506,11 @@ static void* vmem_ensure_next_table(pte_t* tbl, size_t idx, uint64_t raw_flags)
     }
     else
     {
-        next_tbl = frame_alloc();
+        next_tbl = frames_alloc_type(1, FRAME_TYPE_PGTABLE);
         if (next_tbl == NULL)
             return NULL;
 
-        memset(next_tbl, 0, PAGE_SIZE);
+        clear_pages(next_tbl, 1);
         tbl[idx] = (uint64_t)VIRT_TO_PHYS(next_tbl) | PTE_PRESENT | raw_flags;
     }
 
@@ -393,8 +521,9 @@ static int vmem_clone_pages(vmem_t* dst, pml4_t* src_pml4)
 {
     for (size_t pml4ei = 0; pml4ei < 512; pml4ei++)
     {
+        // Shared regions are already linked by vmem_init
         pte_t pml4e = src_pml4->entries[pml4ei];
-        if (!(pml4e & PTE_PRESENT))
+        if (!(pml4e & PTE_PRESENT) || vmem_is_shared(pml4ei))
             continue;
 
         pdpt_t *pdpt = PHYS_TO_VIRT(PTE_ADDR(pml4e));
@@ -406,13 +535,7 @@ static int vmem_clone_pages(vmem_t* dst, pml4_t* src_pml4)
 
             if (pdpte & PTE_PAGE_SIZE)
             {
-                // 1GB pages are not allocated by vmem_alloc_pages
-                // They are mapped to the same physical frames as in the source vmem
-
-                uint64_t virt_addr = MAKE_ADDR(pml4ei, pdpei, 0, 0, 0);
-                uint64_t phys_addr = (uint64_t)PTE_ADDR(pdpte);
-                uint64_t flags = vmem_unconvert_flags(pdpte & PTE_FLAGS_MASK);
-                int res = vmem_map_page_1gb(dst, (void*)virt_addr, (void*)phys_addr, flags);
+                int res = vmem_clone_huge_page(dst, MAKE_ADDR(pml4ei, pdpei, 0, 0, 0), pdpte, GB);
                 if (res < 0)
                     return res;
 
@@ -428,13 +551,7 @@ static int vmem_clone_pages(vmem_t* dst, pml4_t* src_pml4)
 
                 if (pde & PTE_PAGE_SIZE)
                 {
-                    // 2MB pages are not allocated by vmem_alloc_pages
-                    // They are mapped to the same physical frames as in the source vmem
-
-                    uint64_t virt_addr = MAKE_ADDR(pml4ei, pdpei, pdei, 0, 0);
-                    uint64_t phys_addr = (uint64_t)PTE_ADDR(pde);
-                    uint64_t flags = vmem_unconvert_flags(pde & PTE_FLAGS_MASK);
-                    int res = vmem_map_page_2mb(dst, (void*)virt_addr, (void*)phys_addr, flags);
+                    int res = vmem_clone_huge_page(dst, MAKE_ADDR(pml4ei, pdpei, pdei, 0, 0), pde, 2 * MB);
                     if (res < 0)
                         return res;
 
@@ -455,11 +572,12 @@ static int vmem_clone_pages(vmem_t* dst, pml4_t* src_pml4)
                     if (pte & PTE_ALLOC)
                     {
                         // Clone page if it's marked as allocated by vmem_alloc_pages
-                        void* phys_frame_copy = frame_alloc();
+                        void* phys_frame_copy = frames_alloc_type(1, FRAME_TYPE_USER);
                         if (phys_frame_copy == NULL)
                             return -ENOMEM;
 
-                        memcpy(phys_frame_copy, PHYS_TO_VIRT(src_phys_addr), PAGE_SIZE);
+                        copy_page(phys_frame_copy, PHYS_TO_VIRT(src_phys_addr));
+                        pages_copied++;
                         int res = vmem_map_page(dst,
                             (void*)virt_addr, VIRT_TO_PHYS(phys_frame_copy), flags | VMEM_ALLOC);
                         if (res < 0)
@@ -479,3 +597,90 @@ static int vmem_clone_pages(vmem_t* dst, pml4_t* src_pml4)
     
     return 0;
 }
+
+static bool vmem_map_huge_page(vmem_t* vm, vmem_area_t* area, void* fault_addr)
+{
+    uint64_t area_end = area->start + area->size * PAGE_SIZE;
+
+    // 1GB page, if it fits into the area and nothing is mapped there yet
+    uint64_t addr = ROUNDDOWN((uint64_t)fault_addr, GB);
+    if (area->start <= addr && addr + GB <= area_end)
+    {
+        pte_t pml4e = vm->pml4->entries[PML4E_FROM_ADDR(addr)];
+        pdpt_t* pdpt = (pml4e & PTE_PRESENT) ? PHYS_TO_VIRT(PTE_ADDR(pml4e)) : NULL;
+        if (pdpt == NULL || !(pdpt->entries[PDPE_FROM_ADDR(addr)] & PTE_PRESENT))
+        {
+            void* frame = frames_alloc_type(GB / PAGE_SIZE, FRAME_TYPE_USER);
+            if (frame != NULL)
+            {
+                if (vmem_map_page_1gb(vm, (void*)addr, VIRT_TO_PHYS(frame), area->flags | VMEM_ALLOC) == 0)
+                    return true;
+
+                frames_free(frame);
+            }
+        }
+    }
+
+    // Otherwise 2MB page
+    addr = ROUNDDOWN((uint64_t)fault_addr, 2 * MB);
+    if (area->start <= addr && addr + 2 * MB <= area_end)
+    {
+        pte_t pml4e = vm->pml4->entries[PML4E_FROM_ADDR(addr)];
+        pdpt_t* pdpt = (pml4e & PTE_PRESENT) ? PHYS_TO_VIRT(PTE_ADDR(pml4e)) : NULL;
+        pte_t pdpe = pdpt != NULL ? pdpt->entries[PDPE_FROM_ADDR(addr)] : 0;
+        if (pdpe & PTE_PAGE_SIZE)
+            return false;
+
+        pgdir_t* pgdir = (pdpe & PTE_PRESENT) ? PHYS_TO_VIRT(PTE_ADDR(pdpe)) : NULL;
+        if (pgdir == NULL || !(pgdir->entries[PDE_FROM_ADDR(addr)] & PTE_PRESENT))
+        {
+            void* frame = frames_alloc_type(2 * MB / PAGE_SIZE, FRAME_TYPE_USER);
+            if (frame != NULL)
+            {
+                if (vmem_map_page_2mb(vm, (void*)addr, VIRT_TO_PHYS(frame), area->flags | VMEM_ALLOC) == 0)
+                    return true;
+
+                frames_free(frame);
+            }
+        }
+    }
+
+    return false;
+}
+
+static int vmem_clone_huge_page(vmem_t* dst, uint64_t virt_addr, pte_t src_pte, size_t size)
+{
+    uint64_t phys_addr = (uint64_t)PTE_ADDR(src_pte);
+    uint64_t flags = vmem_unconvert_flags(src_pte & PTE_FLAGS_MASK);
+
+    if (src_pte & PTE_ALLOC)
+    {
+        // Clone page if it's allocated by vmem_alloc_pages
+        void* copy = frames_alloc_type(size / PAGE_SIZE, FRAME_TYPE_USER);
+        if (copy == NULL)
+            return -ENOMEM;
+
+        bulk_copy(copy, PHYS_TO_VIRT(phys_addr), size);
+        pages_copied += size / PAGE_SIZE;
+        phys_addr = (uint64_t)VIRT_TO_PHYS(copy);
+    }
+
+    // Otherwise, just map to the same physical frames as in the source vmem
+    if (size == GB)
+        return vmem_map_page_1gb(dst, (void*)virt_addr, (void*)phys_addr, flags);
+    else
+        return vmem_map_page_2mb(dst, (void*)virt_addr, (void*)phys_addr, flags);
+}
+
+void vmem_meminfo(meminfo_t *info)
+{
+    kassert_dbg(info != NULL);
+
+    info->page_faults  = page_faults;
+    info->pages_copied = pages_copied;
+}
+
+static bool vmem_is_shared(size_t pml4ei)
+{
+    return kernel_vmem.pml4 != NULL && (kernel_vmem.pml4->entries[pml4ei] & PTE_PRESENT);
+}
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "mm/paging.h"
 #include "utils/list.h"
+#include "mm/meminfo.h"
 
 #define VMEM_NO_FLAGS 0
 #define VMEM_USER     (1 << 0)
@@ -11,6 +12,8 @@
 // Custom bit - used to mark pages that have been allocated by vmem_alloc_pages
 // (i.e. must be freed when vmem is destroyed)
 #define VMEM_ALLOC (1 << 2)
+// Area is backed by 1GB/2MB pages on demand wherever aligned huge page fits into it
+#define VMEM_HUGE  (1 << 3)
 
 /// Structure which describes continious mapping region
 typedef struct vmem_area
@@ -25,6 +28,9 @@ typedef struct vmem_area
 /// Virtual address space abstraction
 typedef struct vmem
 {
+    // Node in the list of all address spaces
+    list_node_t node;
+
     vmem_area_t *areas_list;
     pml4_t* pml4;
 } vmem_t;
@@ -96,6 +102,44 @@ void vmem_free_pages(vmem_t* vm, void* virt_addr, size_t pgcnt);
  */
 int vmem_map_page(vmem_t* vm, void* virt_addr, void* frame, uint64_t flags);
 
+/**
+ * Unmaps page from given address space, frees its frame if it's allocated by vmem. 
+ * TLB is not flushed
+ * 
+ * \param vm Address space
+ * \param virt_addr Virtual address
+ */
+void vmem_unmap_page(vmem_t* vm, void* virt_addr);
+
+/**
+ * Makes the kernel region covered by a PML4 entry shared by all address spaces, 
+ * including ones created before. Does nothing if the region is already shared
+ * 
+ * \param virt_addr Any address inside the region
+ * 
+ * \return 0 or error code
+ */
+int vmem_share_region(void* virt_addr);
+
+/**
+ * Maps given physical frame into a shared kernel region
+ * 
+ * \param virt_addr Virtual address inside the region
+ * \param frame Physical address
+ * \param flags Flags
+ * 
+ * \return 0 or error code
+ */
+int vmem_map_kernel_page(void* virt_addr, void* frame, uint64_t flags);
+
+/**
+ * Unmaps page from a shared kernel region, frees its frame if it's mapped with VMEM_ALLOC. 
+ * TLB entry of the current CPU is flushed
+ * 
+ * \param virt_addr Virtual address
+ */
+void vmem_unmap_kernel_page(void* virt_addr);
+
 /**
  * Maps given physical 2MB frame into given address space
  * 
@@ -138,6 +182,17 @@ void vmem_destroy(vmem_t* vm);
  */
 vmem_area_t *vmem_is_mapped(vmem_t* vm, void* addr);
 
+/**
+ * Moves contents of the user frame allocated by vmem to the new frame 
+ * and rewrites the page table entry recorded in its descriptor
+ * 
+ * \param old_frame Direct-mapping virtual address of the frame to move
+ * \param new_frame Direct-mapping virtual address of the destination frame
+ * 
+ * \return True if the frame was mapped and has been moved
+ */
+bool vmem_migrate_frame(void* old_frame, void* new_frame);
+
 /**
  * Page fault handler for on-demand allocation
  * 
@@ -147,4 +202,11 @@ vmem_area_t *vmem_is_mapped(vmem_t* vm, void* addr);
  */
 bool vmem_handle_pf(void* fault_addr);
 
+/**
+ * Fills virtual memory part of memory statistics
+ * 
+ * \param info Statistics
+ */
+void vmem_meminfo(meminfo_t *info);
+
 #endif
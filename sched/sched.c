@@ -1,11 +1,14 @@
 #include <stdbool.h>
 #include <linker.h>
 #include <arch/x86/x86.h>
+#include <arch/x86/simd.h>
 #include <kernel/irq.h>
 #include <kernel/panic.h>
 #include <mm/frame_alloc.h>
 #include <mm/obj.h>
 #include <mm/paging.h>
+#include <kernel/kbench.h>
+#include <kernel/time.h>
 #include <sched/sched.h>
 
 #define PREEMPT_TICKS 10
@@ -66,11 +69,21 @@ static int setup_init_task()
     if (err < 0)
         return err;
 
+    err = sched_setup_vdata(new_task);
+    if (err < 0)
+        return err;
+
     // Setup user-space stack.
     err = vmem_alloc_pages(&new_task->vmem, (void*)0x70000000, 4, VMEM_USER | VMEM_WRITE);
     if (err < 0)
         return err;
 
+#ifdef KBENCH
+    err = vmem_alloc_pages(&new_task->vmem, (void*)KBENCH_PF_AREA, KBENCH_SAMPLES, VMEM_USER | VMEM_WRITE);
+    if (err < 0)
+        return err;
+#endif
+
     new_task->state = TASK_RUNNABLE;
 
     err = arch_thread_new(&new_task->arch_thread, NULL);
@@ -80,16 +93,15 @@ static int setup_init_task()
     return 0;
 }
 
-task_t* _current = NULL;
-
 static arch_thread_t sched_context = {};
 static vmem_t sched_vmem = {};
 
 static void sched_switch_to(task_t* next)
 {
-    sched_current() = next;
+    sched_set_current(next);
     // Set CPU time dealdline for the task
     sched_current()->preempt_deadline = sched_timer + PREEMPT_TICKS;
+    next->vdata->sched_timer = sched_timer;
 
     vmem_switch_to(&next->vmem);
     arch_thread_switch(&sched_context, &next->arch_thread);
@@ -110,9 +122,14 @@ void sched_start()
         bool found = false;
         for (size_t i = 0; i < MAX_TASK_COUNT; i++)
         {
-            // Make sleeping task runnable again if it's time
-            if (tasks[i].state == TASK_SLEEPING && sched_timer >= tasks[i].sleep_until)
-                tasks[i].state = TASK_RUNNABLE;
+            // Make sleeping task runnable again if it's time, otherwise get an interrupt by then
+            if (tasks[i].state == TASK_SLEEPING)
+            {
+                if (time_ns() >= tasks[i].sleep_until)
+                    tasks[i].state = TASK_RUNNABLE;
+                else
+                    time_wakeup_at(tasks[i].sleep_until);
+            }
 
             if (tasks[i].state == TASK_RUNNABLE)
             {
@@ -127,6 +144,7 @@ void sched_start()
                     vmem_switch_to(&sched_vmem);
 
                     vmem_destroy(&tasks[i].vmem);
+                    frame_free(tasks[i].vdata);
                     arch_thread_destroy(&tasks[i].arch_thread);
                     printk("sched: pid %d becomes zombie with exit code %d\n", tasks[i].pid, tasks[i].exitcode);
                 }
@@ -141,11 +159,11 @@ void sched_start()
     }
 }
 
-void sched_switch()
+__hot void sched_switch()
 {
-    kassert(_current != NULL);
     task_t* prev = sched_current();
-    sched_current() = NULL;
+    kassert(prev != NULL);
+    sched_set_current(NULL);
     arch_thread_switch(&prev->arch_thread, &sched_context);
 }
 
@@ -154,18 +172,37 @@ void sched_timer_tick()
     sched_timer++;
 
     // Return if we are not in user task now
-    if (!_current)
+    if (!sched_current())
         return;
 
+    sched_current()->vdata->sched_timer = sched_timer;
+
     // We should switch task after some timer ticks
     if (sched_current()->preempt_deadline >= sched_timer)
     {
-        // Task CPU time exceeded - switch to others
-        sched_switch();
-        // Returned to this task at the moment
+        // Task CPU time exceeded - switch to others once the handler leaves the IRQ stack
+        percpu_write(need_resched, true);
     }
 }
 
+void sched_wakeup()
+{
+    // Scheduler wakes tasks up while looking for the next one to run
+    if (sched_current())
+        percpu_write(need_resched, true);
+}
+
+void sched_sleep_until(uint64_t deadline)
+{
+    sched_current()->sleep_until = deadline;
+    sched_current()->state = TASK_SLEEPING;
+    time_wakeup_at(deadline);
+
+    // Go back to scheduler
+    sched_switch();
+    // Returned to this task at the moment
+}
+
 task_t* sched_allocate_task()
 {
     uint64_t curr_pid = 1;
@@ -178,3 +215,32 @@ task_t* sched_allocate_task()
     tasks[curr_pid].pid = curr_pid;
     return &tasks[curr_pid];
 }
+
+int sched_setup_vdata(task_t* task)
+{
+    // Frame is unmovable, so the kernel mapping stays valid
+    vdata_t* vdata = frames_alloc_type(1, FRAME_TYPE_KERNEL);
+    if (vdata == NULL)
+        return -ENOMEM;
+
+    clear_pages(vdata, 1);
+    vdata->pid = task->pid;
+    vdata->sched_timer = sched_timer;
+    vdata->sched_timer_period = SCHED_TIMER_PERIOD;
+    vdata->tsc_base  = time_tsc_base;
+    vdata->tsc_mult  = time_tsc_mult;
+    vdata->tsc_shift = TIME_TSC_SHIFT;
+
+    // Forked task shares parent's page after vmem_clone
+    vmem_unmap_page(&task->vmem, (void*)VDATA_USER_ADDR);
+
+    int err = vmem_map_page(&task->vmem, (void*)VDATA_USER_ADDR, VIRT_TO_PHYS(vdata), VMEM_USER);
+    if (err < 0)
+    {
+        frame_free(vdata);
+        return err;
+    }
+
+    task->vdata = vdata;
+    return 0;
+}
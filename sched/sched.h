@@ -5,6 +5,7 @@
 
 #include <arch/x86/arch.h>
 #include <mm/vmem.h>
+#include <sched/vdata.h>
 
 // Timer period in milliseconds
 #define SCHED_TIMER_PERIOD 10
@@ -30,8 +31,11 @@ typedef struct task
     state_t state;
     uint64_t flags;
     uint64_t preempt_deadline;
+    // Wake up time in nanoseconds, see time_ns()
     uint64_t sleep_until;
     vmem_t vmem;
+    // Kernel mapping of the task's page at VDATA_USER_ADDR
+    vdata_t* vdata;
     int exitcode;
 } task_t;
 
@@ -39,8 +43,8 @@ extern uint64_t sched_timer;
 
 extern task_t tasks[];
 
-extern task_t* _current;
-#define sched_current() _current
+#define sched_current() ((task_t*)percpu_read(current))
+#define sched_set_current(task) percpu_write(current, task)
 
 /**
  * Starts scheduling
@@ -57,6 +61,18 @@ void sched_switch();
  */
 void sched_timer_tick();
 
+/**
+ * Called when a sleeping task may be due to wake up, lets the scheduler run after the interrupt handler
+ */
+void sched_wakeup();
+
+/**
+ * Puts current task to sleep
+ * 
+ * \param deadline Wake up time in nanoseconds, see time_ns()
+ */
+void sched_sleep_until(uint64_t deadline);
+
 /**
  * Allocates task entry
  * 
@@ -64,4 +80,14 @@ void sched_timer_tick();
  */
 task_t* sched_allocate_task();
 
+/**
+ * Maps a new data page at VDATA_USER_ADDR into task's address space and fills it. 
+ * Page inherited from the parent by vmem_clone is replaced
+ * 
+ * \param task Task with initialized address space
+ * 
+ * \return Error code
+ */
+int sched_setup_vdata(task_t* task);
+
 #endif
@@ -1,12 +1,25 @@
 #include <common.h>
 #include <mm/mem_layout.h>
 #include <kernel/syscall.h>
+#include <mm/meminfo.h>
+#include <kernel/kbench.h>
+#include <sched/vdata.h>
+#include <kernel/ring.h>
 
 #define USER_TEXT __attribute__((section(".user.text,\"ax\",@progbits#")))
 
 #define SYSCALL0(n, res) __asm__ volatile ("syscall" : "=a"(res) : "a"(n) : "rdi", "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11", "memory" )
 #define SYSCALL1(n, arg0, res) __asm__ volatile ("syscall" : "=a"(res) : "a"(n), "D"(arg0) : "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11", "memory" )
 #define SYSCALL2(n, arg0, arg1, res) __asm__ volatile ("syscall" :  "=a"(res): "a"(n), "D"(arg0), "S"(arg1) : "rdx", "rcx", "r8", "r9", "r10", "r11", "memory" )
+#define SYSCALL3(n, arg0, arg1, arg2, res) __asm__ volatile ("syscall" :  "=a"(res): "a"(n), "D"(arg0), "S"(arg1), "d"(arg2) : "rcx", "r8", "r9", "r10", "r11", "memory" )
+
+#define vdata() ((const volatile vdata_t*)VDATA_USER_ADDR)
+
+// Same as getpid(), but without entering the kernel
+USER_TEXT int64_t vgetpid()
+{
+    return vdata()->pid;
+}
 
 USER_TEXT int64_t getpid()
 {
@@ -43,6 +56,161 @@ USER_TEXT int64_t wait(uint64_t pid, int* status)
     return res;
 }
 
+USER_TEXT int64_t meminfo(meminfo_t* info, uint64_t size)
+{
+    int64_t res;
+    SYSCALL2(SYS_MEMINFO, info, size, res);
+    return res;
+}
+
+USER_TEXT int64_t clock_gettime()
+{
+    int64_t res;
+    SYSCALL0(SYS_CLOCK_GETTIME, res);
+    return res;
+}
+
+USER_TEXT int64_t nanosleep(uint64_t ns)
+{
+    int64_t res;
+    SYSCALL1(SYS_NANOSLEEP, ns, res);
+    return res;
+}
+
+USER_TEXT int64_t ring_enter(ring_t* ring, uint64_t to_submit)
+{
+    int64_t res;
+    SYSCALL2(SYS_RING_ENTER, ring, to_submit, res);
+    return res;
+}
+
+USER_TEXT uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    __asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Same as clock_gettime(), but without entering the kernel
+USER_TEXT uint64_t vclock_gettime()
+{
+    uint64_t ticks = rdtsc() - vdata()->tsc_base;
+    return ((unsigned __int128)ticks * vdata()->tsc_mult) >> vdata()->tsc_shift;
+}
+
+#ifdef KBENCH
+
+USER_TEXT int64_t kbench(uint64_t op, uint64_t id, uint64_t cycles)
+{
+    int64_t res;
+    SYSCALL3(SYS_KBENCH, op, id, cycles, res);
+    return res;
+}
+
+USER_TEXT int64_t getpid_full()
+{
+    int64_t res;
+    SYSCALL0(SYS_KBENCH_GETPID, res);
+    return res;
+}
+
+USER_TEXT uint64_t rdtscp()
+{
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtscp; lfence" : "=a"(lo), "=d"(hi) : : "rcx", "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// User part of the benchmark suite, see kernel/kbench.c
+USER_TEXT int main()
+{
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        getpid();
+        kbench(KBENCH_OP_RECORD, KBENCH_SYSCALL, rdtscp() - start);
+    }
+
+    // Same syscall with arch_regs_t built and interrupts enabled, the difference is the fast path gain
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        getpid_full();
+        kbench(KBENCH_OP_RECORD, KBENCH_SYSCALL_FULL, rdtscp() - start);
+    }
+
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        vgetpid();
+        kbench(KBENCH_OP_RECORD, KBENCH_VDATA_GETPID, rdtscp() - start);
+    }
+
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        vclock_gettime();
+        kbench(KBENCH_OP_RECORD, KBENCH_VDATA_CLOCK, rdtscp() - start);
+    }
+
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        nanosleep(100000);
+        kbench(KBENCH_OP_RECORD, KBENCH_NANOSLEEP, rdtscp() - start);
+    }
+
+    ring_t ring;
+    ring.sq_head = ring.sq_tail = ring.cq_head = ring.cq_tail = 0;
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        for (uint64_t j = 0; j < KBENCH_RING_BATCH; j++)
+        {
+            ring_sqe_t *sqe = &ring.sqes[ring.sq_tail % RING_ENTRIES];
+            sqe->opcode = SYS_GETPID;
+            sqe->user_data = j;
+            ring.sq_tail++;
+        }
+
+        ring_enter(&ring, KBENCH_RING_BATCH);
+        ring.cq_head = ring.cq_tail;
+        kbench(KBENCH_OP_RECORD, KBENCH_RING, rdtscp() - start);
+    }
+
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        sleep(0);
+        kbench(KBENCH_OP_RECORD, KBENCH_SCHED_YIELD, rdtscp() - start);
+    }
+
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        uint64_t start = rdtsc();
+        int64_t child_pid = fork();
+        if (child_pid == 0)
+            exit(0);
+
+        wait(child_pid, NULL);
+        kbench(KBENCH_OP_RECORD, KBENCH_FORK_WAIT, rdtscp() - start);
+    }
+
+    for (uint64_t i = 0; i < KBENCH_SAMPLES; i++)
+    {
+        volatile uint8_t *page = (volatile uint8_t*)(KBENCH_PF_AREA + i * PAGE_SIZE);
+
+        uint64_t start = rdtsc();
+        *page = 1;
+        kbench(KBENCH_OP_RECORD, KBENCH_PAGE_FAULT, rdtscp() - start);
+    }
+
+    kbench(KBENCH_OP_FINISH, 0, 0);
+    return 0;
+}
+
+#else
+
 USER_TEXT int main()
 {
     int child_pid = fork();
@@ -61,6 +229,8 @@ USER_TEXT int main()
     return 0;
 }
 
+#endif
+
 USER_TEXT void user_program()
 {
     exit(main());
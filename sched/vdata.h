@@ -0,0 +1,29 @@
+#ifndef VDATA_H
+#define VDATA_H
+
+#include <stdint.h>
+
+// Right after the user text page
+#define VDATA_USER_ADDR 0x11000
+
+/**
+ * Kernel-maintained data mapped read-only into every task at VDATA_USER_ADDR, 
+ * so user code can get it without entering the kernel. 
+ * Every field is a naturally aligned 64-bit value written by a single store, so plain loads never see 
+ * a torn value even though sched_timer changes while the task runs. Other fields are set before the task starts
+ */
+typedef struct vdata
+{
+    uint64_t pid;
+    // Value of sched_timer, updated on every tick while the task runs
+    uint64_t sched_timer;
+    // Timer period in milliseconds
+    uint64_t sched_timer_period;
+    // Monotonic time in nanoseconds is ((rdtsc - tsc_base) * tsc_mult) >> tsc_shift with 128-bit product, 
+    // same as SYS_CLOCK_GETTIME returns
+    uint64_t tsc_base;
+    uint64_t tsc_mult;
+    uint64_t tsc_shift;
+} vdata_t;
+
+#endif